@@ -0,0 +1,192 @@
+#include "pixelmatch/executor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pixelmatch {
+
+void SerialExecutor::parallelFor(size_t begin, size_t end,
+                                 const std::function<void(size_t)>& fn) noexcept {
+  for (size_t i = begin; i < end; ++i) {
+    fn(i);
+  }
+}
+
+ThreadExecutor::ThreadExecutor(size_t maxThreads) noexcept : maxThreads_(maxThreads) {}
+
+void ThreadExecutor::parallelFor(size_t begin, size_t end,
+                                 const std::function<void(size_t)>& fn) noexcept {
+  if (begin >= end) {
+    return;
+  }
+
+  std::atomic<size_t> next{begin};
+  const auto worker = [&]() noexcept {
+    for (size_t i = next++; i < end; i = next++) {
+      fn(i);
+    }
+  };
+
+  const size_t maxThreads =
+      maxThreads_ > 0 ? maxThreads_ : std::max(std::thread::hardware_concurrency(), 1u);
+  const size_t numThreads = std::min(maxThreads, end - begin);
+  std::vector<std::thread> threads;
+  try {
+    threads.reserve(numThreads);
+    for (size_t i = 1; i < numThreads; ++i) {
+      threads.emplace_back(worker);
+    }
+  } catch (...) {
+    // Fall through and do the remaining work on this thread.
+  }
+
+  worker();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+PoolExecutor::PoolExecutor(SubmitFunction submit, size_t concurrency) noexcept
+    : submit_(std::move(submit)), concurrency_(std::max<size_t>(concurrency, 1)) {}
+
+void PoolExecutor::parallelFor(size_t begin, size_t end,
+                               const std::function<void(size_t)>& fn) noexcept {
+  if (begin >= end) {
+    return;
+  }
+
+  // Shared with the submitted tasks, which may only start after this call has returned. Tasks only
+  // dereference fn after claiming an index, which cannot happen once all indices are claimed.
+  struct State {
+    std::atomic<size_t> next;
+    size_t end;
+    const std::function<void(size_t)>* fn;
+
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t remaining;
+  };
+
+  std::shared_ptr<State> state;
+  try {
+    state = std::make_shared<State>();
+  } catch (...) {
+    SerialExecutor().parallelFor(begin, end, fn);
+    return;
+  }
+
+  state->next = begin;
+  state->end = end;
+  state->fn = &fn;
+  state->remaining = end - begin;
+
+  const auto worker = [](State& state) noexcept {
+    for (size_t i = state.next++; i < state.end; i = state.next++) {
+      (*state.fn)(i);
+
+      std::lock_guard<std::mutex> lock(state.mutex);
+      if (--state.remaining == 0) {
+        state.done.notify_all();
+      }
+    }
+  };
+
+  const size_t numTasks = std::min(concurrency_, end - begin) - 1;
+  for (size_t i = 0; i < numTasks; ++i) {
+    try {
+      submit_([state, worker]() noexcept { worker(*state); });
+    } catch (...) {
+      // Do the remaining work with the tasks submitted so far.
+      break;
+    }
+  }
+
+  worker(*state);
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->done.wait(lock, [&state]() { return state->remaining == 0; });
+}
+
+void PoolExecutor::submit(std::function<void()> task) noexcept {
+  try {
+    submit_(task);
+  } catch (...) {
+    task();
+  }
+}
+
+ThreadPoolExecutor::ThreadPoolExecutor(size_t numThreads) noexcept {
+  if (numThreads == 0) {
+    numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  try {
+    threads_.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; ++i) {
+      threads_.emplace_back([this]() noexcept { work(); });
+    }
+  } catch (...) {
+    // Run with the workers started so far, or on the calling thread if there are none.
+  }
+}
+
+ThreadPoolExecutor::~ThreadPoolExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+
+  available_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPoolExecutor::parallelFor(size_t begin, size_t end,
+                                     const std::function<void(size_t)>& fn) noexcept {
+  // The calling thread works alongside the workers.
+  PoolExecutor([this](PoolExecutor::Task task) { submit(std::move(task)); }, threads_.size() + 1)
+      .parallelFor(begin, end, fn);
+}
+
+void ThreadPoolExecutor::submit(std::function<void()> task) noexcept {
+  if (threads_.empty()) {
+    task();
+    return;
+  }
+
+  try {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+  } catch (...) {
+    task();
+    return;
+  }
+
+  available_.notify_one();
+}
+
+void ThreadPoolExecutor::work() noexcept {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      available_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    task();
+  }
+}
+
+}  // namespace pixelmatch
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pixelmatch {
+
+/**
+ * Interface used to run parallel loops, such as comparing bands of rows in \ref pixelmatch or
+ * decoding strips in \ref readRgbaImageFromStripedPngFile, on a scheduler chosen by the caller.
+ *
+ * Implement this interface to run the work on an existing thread pool, or use one of the provided
+ * adapters: \ref SerialExecutor, \ref ThreadExecutor, \ref PoolExecutor,
+ * \ref ThreadPoolExecutor, or ParallelAlgorithmsExecutor from
+ * pixelmatch/parallel_algorithms_executor.h.
+ */
+class Executor {
+public:
+  virtual ~Executor() = default;
+
+  /**
+   * Invoke \ref fn once for each index in [begin, end), and return once all invocations have
+   * completed. Invocations may run concurrently and in any order.
+   *
+   * @param begin First index.
+   * @param end One past the last index.
+   * @param fn Function to invoke with each index, must not throw.
+   */
+  virtual void parallelFor(size_t begin, size_t end,
+                           const std::function<void(size_t)>& fn) noexcept = 0;
+
+  /**
+   * Schedule \ref task to run asynchronously, such as by the async I/O functions of
+   * pixelmatch/image_utils.h. The default implementation runs the task on the calling thread
+   * before returning, override it to run tasks on a pool.
+   *
+   * @param task Task to run, must not throw.
+   */
+  virtual void submit(std::function<void()> task) noexcept { task(); }
+};
+
+/**
+ * Executor which runs all work on the calling thread.
+ */
+class SerialExecutor final : public Executor {
+public:
+  void parallelFor(size_t begin, size_t end,
+                   const std::function<void(size_t)>& fn) noexcept override;
+};
+
+/**
+ * Executor which starts std::threads for each parallel loop, and joins them before returning. The
+ * calling thread also runs part of the work.
+ */
+class ThreadExecutor final : public Executor {
+public:
+  /**
+   * Construct the executor.
+   *
+   * @param maxThreads Maximum number of threads to use for each loop, including the calling
+   *                   thread. If 0, uses one thread per hardware core.
+   */
+  explicit ThreadExecutor(size_t maxThreads = 0) noexcept;
+
+  void parallelFor(size_t begin, size_t end,
+                   const std::function<void(size_t)>& fn) noexcept override;
+
+private:
+  size_t maxThreads_;
+};
+
+/**
+ * Executor which runs work on a caller-supplied thread pool, by submitting tasks through a
+ * callback.
+ *
+ * Each loop submits up to concurrency - 1 tasks, and the calling thread works alongside them. The
+ * loop returns as soon as all indices have completed, without waiting for submitted tasks that
+ * have not started yet, so it does not deadlock when called from a thread of a saturated pool.
+ */
+class PoolExecutor final : public Executor {
+public:
+  /// Task submitted to the pool.
+  using Task = std::function<void()>;
+  /// Callback which schedules a task to run on the pool.
+  using SubmitFunction = std::function<void(Task)>;
+
+  /**
+   * Construct the executor.
+   *
+   * @param submit Callback which schedules a task on the pool, such as ThreadPool::enqueue.
+   * @param concurrency Number of threads of the pool to use for each loop, including the calling
+   *                    thread. Should not exceed the size of the pool.
+   */
+  PoolExecutor(SubmitFunction submit, size_t concurrency) noexcept;
+
+  void parallelFor(size_t begin, size_t end,
+                   const std::function<void(size_t)>& fn) noexcept override;
+
+  /// Submits \ref task to the pool, or runs it on the calling thread if submitting fails.
+  void submit(std::function<void()> task) noexcept override;
+
+private:
+  SubmitFunction submit_;
+  size_t concurrency_;
+};
+
+/**
+ * Executor which owns a fixed number of worker threads, started on construction and joined on
+ * destruction. Unlike \ref ThreadExecutor, the number of threads is bounded no matter how many
+ * loops or tasks are submitted, so it can keep many async operations in flight.
+ *
+ * Loops run on the workers and the calling thread, like \ref PoolExecutor. Waiting on the result
+ * of a submitted task from a task of the same executor may deadlock if all workers are busy.
+ */
+class ThreadPoolExecutor final : public Executor {
+public:
+  /**
+   * Construct the executor and start its workers.
+   *
+   * @param numThreads Number of worker threads. If 0, uses one thread per hardware core. If
+   *                   threads cannot be started, tasks run on the calling thread instead.
+   */
+  explicit ThreadPoolExecutor(size_t numThreads = 0) noexcept;
+
+  /// Runs the remaining queued tasks, then joins the workers.
+  ~ThreadPoolExecutor() override;
+
+  ThreadPoolExecutor(const ThreadPoolExecutor&) = delete;
+  ThreadPoolExecutor& operator=(const ThreadPoolExecutor&) = delete;
+
+  void parallelFor(size_t begin, size_t end,
+                   const std::function<void(size_t)>& fn) noexcept override;
+
+  void submit(std::function<void()> task) noexcept override;
+
+private:
+  /// Worker thread loop, runs queued tasks until the executor is destroyed.
+  void work() noexcept;
+
+  std::mutex mutex_;
+  std::condition_variable available_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace pixelmatch
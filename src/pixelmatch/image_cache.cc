@@ -0,0 +1,90 @@
+#include "pixelmatch/image_cache.h"
+
+#include <system_error>
+
+namespace pixelmatch {
+
+ImageCache::ImageCache(size_t memoryBudgetBytes) noexcept : memoryBudgetBytes_(memoryBudgetBytes) {}
+
+std::shared_ptr<const Image> ImageCache::get(const std::string& filename) {
+  std::error_code ec;
+  const std::filesystem::file_time_type modifiedTime =
+      std::filesystem::last_write_time(filename, ec);
+  if (ec) {
+    return nullptr;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(filename);
+    if (it != index_.end()) {
+      if (it->second->modifiedTime == modifiedTime) {
+        // Move to the front of the LRU list.
+        lru_.splice(lru_.begin(), lru_, it->second);
+        ++stats_.hits;
+        return it->second->image;
+      }
+
+      // Stale entry, drop it and reload.
+      stats_.bytesUsed -= it->second->bytes;
+      lru_.erase(it->second);
+      index_.erase(it);
+    }
+
+    ++stats_.misses;
+  }
+
+  // Decode outside of the lock, so that other lookups are not blocked. If two threads miss on the
+  // same image concurrently both decode it, and the last one wins.
+  std::optional<Image> maybeImage = readRgbaImageFromPngFile(filename.c_str());
+  if (!maybeImage) {
+    return nullptr;
+  }
+
+  auto image = std::make_shared<const Image>(std::move(maybeImage.value()));
+  const size_t bytes = image->data.size();
+  if (bytes > memoryBudgetBytes_) {
+    return image;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(filename);
+  if (it != index_.end()) {
+    stats_.bytesUsed -= it->second->bytes;
+    lru_.erase(it->second);
+    index_.erase(it);
+  }
+
+  lru_.push_front(Entry{filename, modifiedTime, image, bytes});
+  index_.emplace(filename, lru_.begin());
+  stats_.bytesUsed += bytes;
+  evictLocked();
+
+  return image;
+}
+
+void ImageCache::clear() noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  lru_.clear();
+  index_.clear();
+  stats_.bytesUsed = 0;
+}
+
+ImageCache::Stats ImageCache::stats() const noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats result = stats_;
+  result.entries = lru_.size();
+  return result;
+}
+
+void ImageCache::evictLocked() noexcept {
+  while (stats_.bytesUsed > memoryBudgetBytes_ && !lru_.empty()) {
+    const Entry& entry = lru_.back();
+    stats_.bytesUsed -= entry.bytes;
+    ++stats_.evictions;
+    index_.erase(entry.filename);
+    lru_.pop_back();
+  }
+}
+
+}  // namespace pixelmatch
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <pixelmatch/image_utils.h>
+
+#include <cstddef>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace pixelmatch {
+
+/**
+ * Thread-safe LRU cache of decoded PNG images, keyed by path and modification time, so that
+ * frequently compared images (such as goldens) are only decoded once.
+ *
+ * When the total size of the decoded pixel data exceeds the memory budget, the least recently used
+ * images are evicted. Images that have been modified on disk since they were cached are reloaded.
+ */
+class ImageCache {
+public:
+  /// Cache statistics, see \ref stats.
+  struct Stats {
+    size_t hits = 0;       //!< Number of lookups served from the cache.
+    size_t misses = 0;     //!< Number of lookups that had to decode the image.
+    size_t evictions = 0;  //!< Number of images evicted to stay within the budget.
+    size_t entries = 0;    //!< Number of images currently cached.
+    size_t bytesUsed = 0;  //!< Size of the pixel data of the cached images, in bytes.
+  };
+
+  /**
+   * Construct a cache.
+   *
+   * @param memoryBudgetBytes Maximum total size of the cached pixel data, in bytes.
+   */
+  explicit ImageCache(size_t memoryBudgetBytes) noexcept;
+
+  ImageCache(const ImageCache&) = delete;
+  ImageCache& operator=(const ImageCache&) = delete;
+
+  /**
+   * Get an image, loading it from disk if it is not cached or has changed.
+   *
+   * An image larger than the whole memory budget is returned, but not cached.
+   *
+   * @param filename Filename of a PNG image.
+   * @return The decoded image, or nullptr if the file could not be read.
+   */
+  std::shared_ptr<const Image> get(const std::string& filename);
+
+  /// Remove all images from the cache.
+  void clear() noexcept;
+
+  /// Returns the current cache statistics.
+  Stats stats() const noexcept;
+
+private:
+  struct Entry {
+    std::string filename;
+    std::filesystem::file_time_type modifiedTime;
+    std::shared_ptr<const Image> image;
+    size_t bytes;
+  };
+
+  /// Evict least recently used entries until the cache is within the memory budget.
+  void evictLocked() noexcept;
+
+  const size_t memoryBudgetBytes_;
+
+  mutable std::mutex mutex_;
+  std::list<Entry> lru_;  //!< Most recently used first.
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  Stats stats_;
+};
+
+}  // namespace pixelmatch
@@ -1,24 +1,277 @@
 #include "pixelmatch/image_utils.h"
 
-#include <stb/stb_image.h>
-#include <stb/stb_image_write.h>
-
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>  // For memcmp.
 #include <fstream>
+#include <memory>
+#include <new>
+#include <utility>
 
 namespace pixelmatch {
 
+namespace {
+
+/// Memory resource for stb allocations on this thread, or nullptr for the default.
+thread_local std::pmr::memory_resource* tlsPngMemoryResource = nullptr;
+
+std::pmr::memory_resource* currentPngMemoryResource() noexcept {
+  return tlsPngMemoryResource ? tlsPngMemoryResource : std::pmr::new_delete_resource();
+}
+
+/// Stored before each stb allocation, since stb frees without passing the size.
+struct alignas(std::max_align_t) PngAllocationHeader {
+  std::pmr::memory_resource* resource;
+  size_t size;
+};
+
+void* pngMalloc(size_t size) noexcept {
+  std::pmr::memory_resource* resource = currentPngMemoryResource();
+  void* block;
+  try {
+    block = resource->allocate(sizeof(PngAllocationHeader) + size, alignof(PngAllocationHeader));
+  } catch (...) {
+    return nullptr;
+  }
+
+  PngAllocationHeader* header = new (block) PngAllocationHeader{resource, size};
+  return header + 1;
+}
+
+void pngFree(void* ptr) noexcept {
+  if (!ptr) {
+    return;
+  }
+
+  PngAllocationHeader* header = static_cast<PngAllocationHeader*>(ptr) - 1;
+  header->resource->deallocate(header, sizeof(PngAllocationHeader) + header->size,
+                               alignof(PngAllocationHeader));
+}
+
+void* pngRealloc(void* ptr, size_t size) noexcept {
+  if (!ptr) {
+    return pngMalloc(size);
+  }
+
+  const PngAllocationHeader* header = static_cast<PngAllocationHeader*>(ptr) - 1;
+  if (size <= header->size) {
+    return ptr;
+  }
+
+  void* result = pngMalloc(size);
+  if (result) {
+    std::memcpy(result, ptr, header->size);
+    pngFree(ptr);
+  }
+
+  return result;
+}
+
+}  // namespace
+
+}  // namespace pixelmatch
+
+// Compile a private copy of stb in this file, so that its allocations can be routed to the
+// memory resource set with setPngMemoryResource.
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_MALLOC(size) pixelmatch::pngMalloc(size)
+#define STBI_REALLOC(ptr, size) pixelmatch::pngRealloc(ptr, size)
+#define STBI_FREE(ptr) pixelmatch::pngFree(ptr)
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#define STBIW_MALLOC(size) pixelmatch::pngMalloc(size)
+#define STBIW_REALLOC(ptr, size) pixelmatch::pngRealloc(ptr, size)
+#define STBIW_FREE(ptr) pixelmatch::pngFree(ptr)
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#endif
+
+#include <stb/stb_image.h>
+#include <stb/stb_image_write.h>
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace pixelmatch {
+
+namespace {
+
+/// Deleter for buffers from the PNG memory resource, including the pixels returned by stb.
+struct PngFree {
+  void operator()(void* ptr) const noexcept { pngFree(ptr); }
+};
+
+template <typename T>
+using PngBuffer = std::unique_ptr<T, PngFree>;
+
+/**
+ * Read the entire contents of a file into a buffer from the PNG memory resource, with a small
+ * stream buffer on the stack, so that neither the stream nor the file contents are allocated from
+ * the global heap. The file is read with a single large read, which bypasses the stream buffer.
+ *
+ * @param filename Path to the file.
+ * @param size Set to the size of the file.
+ * @return The file contents, or null if the file cannot be read.
+ */
+PngBuffer<uint8_t> readFileBytes(const char* filename, size_t& size) noexcept {
+  char streamBuffer[256];
+  std::ifstream input;
+  input.rdbuf()->pubsetbuf(streamBuffer, sizeof(streamBuffer));
+  input.open(filename, std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+  if (!input) {
+    return nullptr;
+  }
+
+  const std::streamoff fileSize = input.tellg();
+  if (fileSize < 0 || static_cast<uint64_t>(fileSize) > SIZE_MAX - sizeof(PngAllocationHeader)) {
+    return nullptr;
+  }
+
+  PngBuffer<uint8_t> bytes(static_cast<uint8_t*>(pngMalloc(static_cast<size_t>(fileSize))));
+  if (!bytes) {
+    return nullptr;
+  }
+
+  input.seekg(0);
+  if (!input.read(reinterpret_cast<char*>(bytes.get()), fileSize)) {
+    return nullptr;
+  }
+
+  size = static_cast<size_t>(fileSize);
+  return bytes;
+}
+
+/// Run \ref task on \ref executor, or on the calling thread if it is null.
+void runTask(Executor* executor, std::function<void()> task) noexcept {
+  if (executor) {
+    executor->submit(std::move(task));
+  } else {
+    task();
+  }
+}
+
+constexpr char kStripedMagic[8] = {'P', 'X', 'M', 'S', 'T', 'R', 'I', 'P'};
+constexpr uint32_t kStripedVersion = 1;
+constexpr size_t kStripedHeaderBytes = sizeof(kStripedMagic) + 5 * sizeof(uint32_t);
+
+/// Upper bound of the deflate compression ratio, which bounds the pixels a PNG of a given size
+/// can hold: each row is stored with a filter byte, and deflate cannot exceed about 1032:1.
+constexpr uint64_t kMaxDeflateRatio = 1032;
+
+void appendLittleEndian(std::vector<uint8_t>& output, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; ++i) {
+    output.push_back(static_cast<uint8_t>(value >> (i * 8)));
+  }
+}
+
+uint64_t readLittleEndian(const uint8_t* data, size_t bytes) noexcept {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; ++i) {
+    value |= static_cast<uint64_t>(data[i]) << (i * 8);
+  }
+  return value;
+}
+
+}  // namespace
+
+std::pmr::memory_resource* setPngMemoryResource(std::pmr::memory_resource* resource) noexcept {
+  return std::exchange(tlsPngMemoryResource, resource);
+}
+
 std::optional<Image> readRgbaImageFromPngFile(const char* filename) noexcept {
+  Image result{};
+  if (!readRgbaImageFromPngFile(filename, result)) {
+    return std::nullopt;
+  }
+
+  return result;
+}
+
+bool readRgbaImageFromPngFile(const char* filename, Image& image) noexcept {
+  size_t size = 0;
+  const PngBuffer<uint8_t> bytes = readFileBytes(filename, size);
+  return bytes && readRgbaImageFromPngMemory(span<const uint8_t>(bytes.get(), size), image);
+}
+
+std::optional<Image16> readRgba16ImageFromPngFile(const char* filename) noexcept {
+  size_t size = 0;
+  const PngBuffer<uint8_t> bytes = readFileBytes(filename, size);
+  if (!bytes || size > static_cast<size_t>(INT_MAX)) {
+    return std::nullopt;
+  }
+
   int width, height, channels;
-  auto data = stbi_load(filename, &width, &height, &channels, 4);
+  const PngBuffer<stbi_us> data(stbi_load_16_from_memory(bytes.get(), static_cast<int>(size),
+                                                         &width, &height, &channels, 4));
   if (!data) {
     return std::nullopt;
   }
 
-  Image result{width, height, static_cast<size_t>(width),
-               std::vector<uint8_t>(data, data + width * height * 4)};
+  try {
+    const size_t valueCount = static_cast<size_t>(width) * static_cast<size_t>(height) * 4;
+    return Image16{width, height, static_cast<size_t>(width),
+                   std::vector<uint16_t>(data.get(), data.get() + valueCount)};
+  } catch (...) {
+    return std::nullopt;
+  }
+}
+
+std::optional<Image> readRgbaImageFromPngMemory(span<const uint8_t> pngData) noexcept {
+  Image result{};
+  if (!readRgbaImageFromPngMemory(pngData, result)) {
+    return std::nullopt;
+  }
+
+  return result;
+}
+
+bool readRgbaImageFromPngMemory(span<const uint8_t> pngData, Image& image) noexcept {
+  if (pngData.size() > static_cast<size_t>(INT_MAX)) {
+    return false;
+  }
+
+  int width, height, channels;
+  auto data = stbi_load_from_memory(pngData.data(), static_cast<int>(pngData.size()), &width,
+                                    &height, &channels, 4);
+  if (!data) {
+    return false;
+  }
+
+  try {
+    image.data.assign(data, data + static_cast<size_t>(width) * height * 4);
+  } catch (...) {
+    stbi_image_free(data);
+    return false;
+  }
+
+  image.width = width;
+  image.height = height;
+  image.strideInPixels = static_cast<size_t>(width);
   stbi_image_free(data);
+  return true;
+}
+
+std::future<std::optional<Image>> readRgbaImageFromPngFileAsync(std::string filename,
+                                                                Executor* executor) {
+  auto promise = std::make_shared<std::promise<std::optional<Image>>>();
+  std::future<std::optional<Image>> result = promise->get_future();
+  runTask(executor, [promise, filename = std::move(filename)]() noexcept {
+    // Read the file contents before decoding, so that blocking I/O is not interleaved with
+    // decompression.
+    size_t size = 0;
+    const PngBuffer<uint8_t> bytes = readFileBytes(filename.c_str(), size);
+    promise->set_value(bytes ? readRgbaImageFromPngMemory(span<const uint8_t>(bytes.get(), size))
+                             : std::nullopt);
+  });
   return result;
 }
 
@@ -30,8 +283,12 @@ bool writeRgbaPixelsToPngFile(const char* filename, span<const uint8_t> rgbaPixe
 
   assert(rgbaPixels.size() == strideInPixels * height * 4);
 
+  // stb passes the whole encoded image at once, which bypasses the stream buffer, so use a small
+  // one on the stack instead of letting the stream allocate one.
+  char streamBuffer[256];
   Context context;
-  context.output = std::ofstream(filename, std::ofstream::out | std::ofstream::binary);
+  context.output.rdbuf()->pubsetbuf(streamBuffer, sizeof(streamBuffer));
+  context.output.open(filename, std::ofstream::out | std::ofstream::binary);
   if (!context.output) {
     return false;
   }
@@ -46,6 +303,209 @@ bool writeRgbaPixelsToPngFile(const char* filename, span<const uint8_t> rgbaPixe
   return context.output.good();
 }
 
+std::optional<std::vector<uint8_t>> writeRgbaPixelsToPngMemory(span<const uint8_t> rgbaPixels,
+                                                               int width, int height,
+                                                               size_t strideInPixels) noexcept {
+  std::vector<uint8_t> result;
+  if (!writeRgbaPixelsToPngMemory(rgbaPixels, width, height, strideInPixels, result)) {
+    return std::nullopt;
+  }
+
+  return result;
+}
+
+bool writeRgbaPixelsToPngMemory(span<const uint8_t> rgbaPixels, int width, int height,
+                                size_t strideInPixels, std::vector<uint8_t>& output) noexcept {
+  assert(rgbaPixels.size() == strideInPixels * height * 4);
+
+  // The callback cannot report failure to stb, so it records it and ignores further writes.
+  struct WriteContext {
+    std::vector<uint8_t>* output;
+    bool failed;
+  } context{&output, false};
+
+  output.clear();
+  const int success = stbi_write_png_to_func(
+      [](void* contextPtr, void* data, int len) noexcept {
+        WriteContext* context = static_cast<WriteContext*>(contextPtr);
+        if (context->failed) {
+          return;
+        }
+
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        try {
+          context->output->insert(context->output->end(), bytes, bytes + len);
+        } catch (...) {
+          context->failed = true;
+        }
+      },
+      &context, width, height, 4, rgbaPixels.data(), strideInPixels * 4);
+  return success != 0 && !context.failed;
+}
+
+std::future<bool> writeRgbaPixelsToPngFileAsync(std::string filename,
+                                                std::vector<uint8_t> rgbaPixels, int width,
+                                                int height, size_t strideInPixels,
+                                                Executor* executor) {
+  auto promise = std::make_shared<std::promise<bool>>();
+  std::future<bool> result = promise->get_future();
+  auto pixels = std::make_shared<std::vector<uint8_t>>(std::move(rgbaPixels));
+  runTask(executor, [promise, pixels, filename = std::move(filename), width, height,
+                     strideInPixels]() noexcept {
+    // Encode fully before opening the file, so that the file is written with a single large
+    // write.
+    const std::optional<std::vector<uint8_t>> encoded =
+        writeRgbaPixelsToPngMemory(*pixels, width, height, strideInPixels);
+    if (!encoded) {
+      promise->set_value(false);
+      return;
+    }
+
+    std::ofstream output(filename, std::ofstream::out | std::ofstream::binary);
+    output.write(reinterpret_cast<const char*>(encoded->data()),
+                 static_cast<std::streamsize>(encoded->size()));
+    promise->set_value(output.good());
+  });
+  return result;
+}
+
+bool writeRgbaPixelsToStripedPngFile(const char* filename, span<const uint8_t> rgbaPixels,
+                                     int width, int height, size_t strideInPixels,
+                                     int rowsPerStrip, Executor* executor) noexcept {
+  assert(rgbaPixels.size() == strideInPixels * height * 4);
+  if (width <= 0 || height <= 0 || rowsPerStrip <= 0) {
+    return false;
+  }
+
+  const size_t stripCount = (static_cast<size_t>(height) + rowsPerStrip - 1) / rowsPerStrip;
+  std::vector<std::optional<std::vector<uint8_t>>> strips(stripCount);
+
+  SerialExecutor defaultExecutor;
+  Executor& stripExecutor = executor ? *executor : defaultExecutor;
+  std::pmr::memory_resource* const resource = tlsPngMemoryResource;
+  stripExecutor.parallelFor(0, stripCount, [&](size_t i) noexcept {
+    const ScopedPngMemoryResource scopedResource(resource);
+    const int firstRow = static_cast<int>(i) * rowsPerStrip;
+    const int rows = std::min(rowsPerStrip, height - firstRow);
+    const span<const uint8_t> stripPixels(&rgbaPixels[firstRow * strideInPixels * 4],
+                                          rows * strideInPixels * 4);
+    strips[i] = writeRgbaPixelsToPngMemory(stripPixels, width, rows, strideInPixels);
+  });
+
+  std::vector<uint8_t> header(kStripedMagic, kStripedMagic + sizeof(kStripedMagic));
+  appendLittleEndian(header, kStripedVersion, sizeof(uint32_t));
+  appendLittleEndian(header, width, sizeof(uint32_t));
+  appendLittleEndian(header, height, sizeof(uint32_t));
+  appendLittleEndian(header, rowsPerStrip, sizeof(uint32_t));
+  appendLittleEndian(header, stripCount, sizeof(uint32_t));
+  for (const std::optional<std::vector<uint8_t>>& strip : strips) {
+    if (!strip) {
+      return false;
+    }
+
+    appendLittleEndian(header, strip->size(), sizeof(uint64_t));
+  }
+
+  std::ofstream output(filename, std::ofstream::out | std::ofstream::binary);
+  if (!output) {
+    return false;
+  }
+
+  output.write(reinterpret_cast<const char*>(header.data()),
+               static_cast<std::streamsize>(header.size()));
+  for (const std::optional<std::vector<uint8_t>>& strip : strips) {
+    output.write(reinterpret_cast<const char*>(strip->data()),
+                 static_cast<std::streamsize>(strip->size()));
+  }
+
+  return output.good();
+}
+
+std::optional<Image> readRgbaImageFromStripedPngFile(const char* filename,
+                                                     Executor* executor) noexcept {
+  size_t fileSize = 0;
+  const PngBuffer<uint8_t> fileBytes = readFileBytes(filename, fileSize);
+  if (!fileBytes || fileSize < kStripedHeaderBytes ||
+      std::memcmp(fileBytes.get(), kStripedMagic, sizeof(kStripedMagic)) != 0) {
+    return std::nullopt;
+  }
+
+  const span<const uint8_t> bytes(fileBytes.get(), fileSize);
+  const uint8_t* fields = bytes.data() + sizeof(kStripedMagic);
+  const uint64_t version = readLittleEndian(fields, sizeof(uint32_t));
+  const uint64_t width = readLittleEndian(fields + 4, sizeof(uint32_t));
+  const uint64_t height = readLittleEndian(fields + 8, sizeof(uint32_t));
+  const uint64_t rowsPerStrip = readLittleEndian(fields + 12, sizeof(uint32_t));
+  const uint64_t stripCount = readLittleEndian(fields + 16, sizeof(uint32_t));
+
+  if (version != kStripedVersion || width == 0 || width > INT_MAX || height == 0 ||
+      height > INT_MAX || rowsPerStrip == 0 ||
+      stripCount != (height + rowsPerStrip - 1) / rowsPerStrip ||
+      bytes.size() < kStripedHeaderBytes + stripCount * sizeof(uint64_t)) {
+    return std::nullopt;
+  }
+
+  // Locate each strip before decoding, so that the strips can be decoded independently. The
+  // header is not trusted: each strip must be large enough to plausibly hold its rows, so that a
+  // corrupt or malicious header cannot request a huge allocation for the image.
+  std::vector<span<const uint8_t>> strips;
+  Image result{static_cast<int>(width), static_cast<int>(height), static_cast<size_t>(width),
+               std::vector<uint8_t>()};
+  try {
+    strips.reserve(stripCount);
+    size_t offset = kStripedHeaderBytes + stripCount * sizeof(uint64_t);
+    for (uint64_t i = 0; i < stripCount; ++i) {
+      const uint8_t* sizeField = bytes.data() + kStripedHeaderBytes + i * sizeof(uint64_t);
+      const uint64_t size = readLittleEndian(sizeField, sizeof(uint64_t));
+      const uint64_t rows = std::min(rowsPerStrip, height - i * rowsPerStrip);
+      if (size > bytes.size() - offset || size > static_cast<uint64_t>(INT_MAX) ||
+          rows > size * kMaxDeflateRatio / (width * 4 + 1)) {
+        return std::nullopt;
+      }
+
+      strips.emplace_back(bytes.data() + offset, static_cast<size_t>(size));
+      offset += size;
+    }
+
+    result.data.resize(width * height * 4);
+  } catch (...) {
+    return std::nullopt;
+  }
+
+  std::atomic<bool> failed{false};
+
+  SerialExecutor defaultExecutor;
+  Executor& stripExecutor = executor ? *executor : defaultExecutor;
+  std::pmr::memory_resource* const resource = tlsPngMemoryResource;
+  stripExecutor.parallelFor(0, strips.size(), [&](size_t i) noexcept {
+    const ScopedPngMemoryResource scopedResource(resource);
+    const uint64_t firstRow = i * rowsPerStrip;
+    const uint64_t rows = std::min(rowsPerStrip, height - firstRow);
+
+    int stripWidth, stripHeight, channels;
+    uint8_t* data = stbi_load_from_memory(strips[i].data(), static_cast<int>(strips[i].size()),
+                                          &stripWidth, &stripHeight, &channels, 4);
+    if (!data) {
+      failed = true;
+      return;
+    }
+
+    if (static_cast<uint64_t>(stripWidth) != width || static_cast<uint64_t>(stripHeight) != rows) {
+      failed = true;
+    } else {
+      std::memcpy(&result.data[firstRow * width * 4], data, rows * width * 4);
+    }
+
+    stbi_image_free(data);
+  });
+
+  if (failed) {
+    return std::nullopt;
+  }
+
+  return result;
+}
+
 bool imageEquals(span<const uint8_t> img1, span<const uint8_t> img2, int width, int height,
                  size_t strideInPixels) noexcept {
   // Check for identical images, respecting stride.
@@ -1,19 +1,69 @@
 #pragma once
 
+#include <pixelmatch/executor.h>
 #include <pixelmatch/pixelmatch.h>
 
+#include <future>
+#include <memory_resource>
+#include <string>
 #include <vector>
 
 namespace pixelmatch {
 
 /**
- * Container for Image data returned by \ref readRgbaImageFromPngFile.
+ * Container for Image data returned by \ref readRgbaImageFromPngFile and
+ * \ref readRgba16ImageFromPngFile.
+ *
+ * @tparam T Channel type, uint8_t for 8-bit images or uint16_t for 16-bit images.
  */
-struct Image {
-  int width;                  //!< Image width in pixels.
-  int height;                 //!< Image height in pixels.
-  size_t strideInPixels;      //!< Image stride, in pixels. Should be >= width.
-  std::vector<uint8_t> data;  //!< Image data as RGBA-encoded pixels, unpremultiplied.
+template <typename T>
+struct BasicImage {
+  int width;              //!< Image width in pixels.
+  int height;             //!< Image height in pixels.
+  size_t strideInPixels;  //!< Image stride, in pixels. Should be >= width.
+  std::vector<T> data;    //!< Image data as RGBA-encoded pixels, unpremultiplied.
+};
+
+/// Image with 8 bits per channel.
+using Image = BasicImage<uint8_t>;
+
+/// Image with 16 bits per channel.
+using Image16 = BasicImage<uint16_t>;
+
+/**
+ * Sets the memory resource used on the calling thread for the internal allocations of PNG decoding
+ * and encoding, such as file contents, zlib buffers and decoded pixels before they are copied into
+ * an \ref Image.
+ *
+ * Combined with the overloads which reuse an existing \ref Image or output buffer, this allows
+ * loading, comparing and saving images without allocating from the global heap once buffers have
+ * reached their steady-state size.
+ *
+ * The striped functions propagate the resource to the executor running each strip, so it must be
+ * thread-safe if the executor runs strips in parallel. The async functions use the resource of the
+ * thread they run on.
+ *
+ * @param resource Memory resource to use, or nullptr to use std::pmr::new_delete_resource(). Must
+ *                 outlive its use by the calling thread.
+ * @return The previous memory resource of the calling thread, or nullptr if it was the default.
+ */
+std::pmr::memory_resource* setPngMemoryResource(std::pmr::memory_resource* resource) noexcept;
+
+/**
+ * Sets the PNG memory resource of the calling thread for the lifetime of this object, see
+ * \ref setPngMemoryResource.
+ */
+class ScopedPngMemoryResource {
+public:
+  explicit ScopedPngMemoryResource(std::pmr::memory_resource* resource) noexcept
+      : previous_(setPngMemoryResource(resource)) {}
+  ~ScopedPngMemoryResource() { setPngMemoryResource(previous_); }
+
+  ScopedPngMemoryResource(const ScopedPngMemoryResource&) = delete;
+  ScopedPngMemoryResource& operator=(const ScopedPngMemoryResource&) = delete;
+
+private:
+  std::pmr::memory_resource* previous_;
 };
 
 /**
@@ -24,6 +74,61 @@ struct Image {
  */
 std::optional<Image> readRgbaImageFromPngFile(const char* filename) noexcept;
 
+/**
+ * Reads an image from a PNG file into an existing \ref Image, reusing its pixel buffer if it is
+ * large enough.
+ *
+ * @param filename Filename to load.
+ * @param image Destination image, which is left unchanged if the file could not be read.
+ * @return true if the image was successfully read.
+ */
+bool readRgbaImageFromPngFile(const char* filename, Image& image) noexcept;
+
+/**
+ * Reads an image from a PNG file with 16 bits per channel, without losing precision for 16-bit
+ * PNGs. 8-bit PNGs are expanded to 16 bits.
+ *
+ * @param filename Filename to load.
+ * @return std::optional<Image16> containing the image, or std::nullopt if the file could not be
+ *         read.
+ */
+std::optional<Image16> readRgba16ImageFromPngFile(const char* filename) noexcept;
+
+/**
+ * Decodes a PNG image that has already been loaded into memory.
+ *
+ * @param pngData Encoded PNG file contents.
+ * @return std::optional<Image> containing the image, or std::nullopt if the data could not be
+ *         decoded.
+ */
+std::optional<Image> readRgbaImageFromPngMemory(span<const uint8_t> pngData) noexcept;
+
+/**
+ * Decodes a PNG image from memory into an existing \ref Image, reusing its pixel buffer if it is
+ * large enough.
+ *
+ * @param pngData Encoded PNG file contents.
+ * @param image Destination image, which is left unchanged if the data could not be decoded.
+ * @return true if the image was successfully decoded.
+ */
+bool readRgbaImageFromPngMemory(span<const uint8_t> pngData, Image& image) noexcept;
+
+/**
+ * Asynchronously reads an image from a PNG file.
+ *
+ * The file contents are read and decoded as a task submitted to \ref executor, so that many files
+ * can be kept in flight at once when reading from a slow filesystem. Use a
+ * \ref ThreadPoolExecutor, or a \ref PoolExecutor on an existing pool, to bound the number of
+ * threads doing I/O.
+ *
+ * @param filename Filename to load.
+ * @param executor Executor to submit the read to, or nullptr to read on the calling thread before
+ *                 returning.
+ * @return A future which resolves to the image, or std::nullopt if the file could not be read.
+ */
+std::future<std::optional<Image>> readRgbaImageFromPngFileAsync(std::string filename,
+                                                                Executor* executor = nullptr);
+
 /**
  * Save an image as a PNG file.
  *
@@ -37,6 +142,88 @@ std::optional<Image> readRgbaImageFromPngFile(const char* filename) noexcept;
 bool writeRgbaPixelsToPngFile(const char* filename, span<const uint8_t> rgbaPixels, int width,
                               int height, size_t strideInPixels) noexcept;
 
+/**
+ * Encode an image as PNG into memory.
+ *
+ * @param rgbaPixels Pixel data, as RGBA-encoded pixels. Alpha should be unpremultiplied.
+ * @param width Width of the image.
+ * @param height Height of the image.
+ * @param strideInPixels Stride of the image pixel data, should be greater than \ref width.
+ * @return std::optional containing the encoded PNG file contents, or std::nullopt if encoding
+ *         failed.
+ */
+std::optional<std::vector<uint8_t>> writeRgbaPixelsToPngMemory(span<const uint8_t> rgbaPixels,
+                                                               int width, int height,
+                                                               size_t strideInPixels) noexcept;
+
+/**
+ * Encode an image as PNG into an existing buffer, reusing its capacity if it is large enough.
+ *
+ * @param rgbaPixels Pixel data, as RGBA-encoded pixels. Alpha should be unpremultiplied.
+ * @param width Width of the image.
+ * @param height Height of the image.
+ * @param strideInPixels Stride of the image pixel data, should be greater than \ref width.
+ * @param output Replaced with the encoded PNG file contents.
+ * @return true if the image was successfully encoded.
+ */
+bool writeRgbaPixelsToPngMemory(span<const uint8_t> rgbaPixels, int width, int height,
+                                size_t strideInPixels, std::vector<uint8_t>& output) noexcept;
+
+/**
+ * Asynchronously save an image as a PNG file.
+ *
+ * Encoding and writing happen in a task submitted to \ref executor. The pixel data is moved into
+ * the operation so that the caller does not need to keep it alive.
+ *
+ * @param filename Destination filename.
+ * @param rgbaPixels Pixel data, as RGBA-encoded pixels. Alpha should be unpremultiplied.
+ * @param width Width of the image.
+ * @param height Height of the image.
+ * @param strideInPixels Stride of the image pixel data, should be greater than \ref width.
+ * @param executor Executor to submit the write to, or nullptr to write on the calling thread
+ *                 before returning.
+ * @return A future which resolves to true if the image was successfully saved.
+ */
+std::future<bool> writeRgbaPixelsToPngFileAsync(std::string filename,
+                                                std::vector<uint8_t> rgbaPixels, int width,
+                                                int height, size_t strideInPixels,
+                                                Executor* executor = nullptr);
+
+/**
+ * Save an image as a striped PNG container, which can be decoded in parallel by
+ * \ref readRgbaImageFromStripedPngFile.
+ *
+ * The image is split into horizontal strips of \ref rowsPerStrip rows, and each strip is stored as
+ * an independent PNG. The file layout, with all integers little-endian, is:
+ * - 8-byte magic "PXMSTRIP".
+ * - uint32 version (1), width, height, rows per strip and strip count.
+ * - One uint64 byte size per strip.
+ * - The PNG data for each strip, top to bottom.
+ *
+ * @param filename Destination filename.
+ * @param rgbaPixels Pixel data, as RGBA-encoded pixels. Alpha should be unpremultiplied.
+ * @param width Width of the image.
+ * @param height Height of the image.
+ * @param strideInPixels Stride of the image pixel data, should be greater than \ref width.
+ * @param rowsPerStrip Number of rows to store in each strip, must be > 0.
+ * @param executor Executor to encode the strips on, or nullptr to run on the calling thread.
+ * @return true If the image was successfully saved.
+ */
+bool writeRgbaPixelsToStripedPngFile(const char* filename, span<const uint8_t> rgbaPixels,
+                                     int width, int height, size_t strideInPixels,
+                                     int rowsPerStrip = 256,
+                                     Executor* executor = nullptr) noexcept;
+
+/**
+ * Reads an image saved with \ref writeRgbaPixelsToStripedPngFile, decoding the strips in parallel.
+ *
+ * @param filename Filename to load.
+ * @param executor Executor to decode the strips on, or nullptr to run on the calling thread.
+ * @return std::optional<Image> containing the image, or std::nullopt if the file could not be read.
+ */
+std::optional<Image> readRgbaImageFromStripedPngFile(const char* filename,
+                                                     Executor* executor = nullptr) noexcept;
+
 /**
  * Returns true if two images are bit-identical.
  *
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <pixelmatch/executor.h>
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#if __has_include(<execution>)
+#include <execution>
+#endif
+
+namespace pixelmatch {
+
+#if defined(__cpp_lib_execution)
+
+/**
+ * Executor which runs loops with the C++17 parallel algorithms, using std::execution::par.
+ *
+ * This adapter is header-only so that the library does not depend on the parallel backend of the
+ * standard library. With libstdc++, targets which use it must link the TBB backend (-ltbb).
+ */
+class ParallelAlgorithmsExecutor final : public Executor {
+public:
+  void parallelFor(size_t begin, size_t end,
+                   const std::function<void(size_t)>& fn) noexcept override {
+    std::vector<size_t> indices;
+    try {
+      indices.resize(end > begin ? end - begin : 0);
+    } catch (...) {
+      SerialExecutor().parallelFor(begin, end, fn);
+      return;
+    }
+
+    std::iota(indices.begin(), indices.end(), begin);
+    std::for_each(std::execution::par, indices.begin(), indices.end(),
+                  [&fn](size_t i) noexcept { fn(i); });
+  }
+};
+
+#endif  // defined(__cpp_lib_execution)
+
+}  // namespace pixelmatch
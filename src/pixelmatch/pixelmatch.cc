@@ -1,25 +1,68 @@
 
 #include "pixelmatch/pixelmatch.h"
 
+#include "pixelmatch/executor.h"
+
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
-#include <cstring>  // For memcmp.
+#include <cmath>
+#include <cstring>  // For memcmp and memcpy.
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <type_traits>
+#include <vector>
 
 namespace pixelmatch {
 
 namespace {
 
-static constexpr size_t kPixelBytes = 4;
+static constexpr size_t kPixelChannels = 4;
+
+/**
+ * Describes the range of a channel type supported by the comparison kernels.
+ */
+template <typename T>
+struct ChannelTraits;
+
+template <>
+struct ChannelTraits<uint8_t> {
+  static constexpr float kMax = 255.0f;  //!< Value of a fully saturated channel.
+};
+
+template <>
+struct ChannelTraits<uint16_t> {
+  static constexpr float kMax = 65535.0f;  //!< Value of a fully saturated channel.
+};
+
+template <>
+struct ChannelTraits<float> {
+  static constexpr float kMax = 1.0f;  //!< Value of a fully saturated channel.
+};
+
+/// Convert an 8-bit color channel to the given channel type.
+template <typename T>
+inline T fromColorChannel(uint8_t c) noexcept {
+  if constexpr (std::is_same_v<T, uint8_t>) {
+    return c;
+  } else if constexpr (std::is_same_v<T, uint16_t>) {
+    return static_cast<uint16_t>(c * 257);
+  } else {
+    return static_cast<T>(c) / 255.0f;
+  }
+}
 
-inline float rgb2y(uint8_t r, uint8_t g, uint8_t b) noexcept {
+inline float rgb2y(float r, float g, float b) noexcept {
   return r * 0.29889531f + g * 0.58662247f + b * 0.11448223f;
 }
 
-inline float rgb2i(uint8_t r, uint8_t g, uint8_t b) noexcept {
+inline float rgb2i(float r, float g, float b) noexcept {
   return r * 0.59597799f - g * 0.27417610f - b * 0.32180189f;
 }
 
-inline float rgb2q(uint8_t r, uint8_t g, uint8_t b) noexcept {
+inline float rgb2q(float r, float g, float b) noexcept {
   return r * 0.21147017f - g * 0.52261711f + b * 0.31114694f;
 }
 
@@ -30,8 +73,10 @@ inline float rgb2q(uint8_t r, uint8_t g, uint8_t b) noexcept {
  * @param alpha The alpha value of the color, between 0 and 1.
  * @return The blended color.
  */
-inline uint8_t blend(uint8_t c, float a) noexcept {
-  return static_cast<uint8_t>(255.0f + (static_cast<float>(c) - 255.0f) * a);
+template <typename T>
+inline T blend(T c, float a) noexcept {
+  constexpr float kMax = ChannelTraits<T>::kMax;
+  return static_cast<T>(kMax + (static_cast<float>(c) - kMax) * a);
 }
 
 /**
@@ -47,32 +92,35 @@ inline uint8_t blend(uint8_t c, float a) noexcept {
  * @return the delta, with sign indicating whether the pixel lightens or darkens the pixel lightens
  *          or darkens (positive if img2 lightens). Returns 0 if the pixels are identical.
  */
-float colorDelta(span<const uint8_t> img1, span<const uint8_t> img2, size_t pos1, size_t pos2,
+template <typename T>
+float colorDelta(span<const T> img1, span<const T> img2, size_t pos1, size_t pos2,
                  bool yOnly) noexcept {
-  uint8_t r1 = img1[pos1 + 0];
-  uint8_t g1 = img1[pos1 + 1];
-  uint8_t b1 = img1[pos1 + 2];
-  const uint8_t a1 = img1[pos1 + 3];
+  constexpr float kMax = ChannelTraits<T>::kMax;
 
-  uint8_t r2 = img2[pos2 + 0];
-  uint8_t g2 = img2[pos2 + 1];
-  uint8_t b2 = img2[pos2 + 2];
-  const uint8_t a2 = img2[pos2 + 3];
+  T r1 = img1[pos1 + 0];
+  T g1 = img1[pos1 + 1];
+  T b1 = img1[pos1 + 2];
+  const T a1 = img1[pos1 + 3];
+
+  T r2 = img2[pos2 + 0];
+  T g2 = img2[pos2 + 1];
+  T b2 = img2[pos2 + 2];
+  const T a2 = img2[pos2 + 3];
 
   if (r1 == r2 && g1 == g2 && b1 == b2 && a1 == a2) {
     return 0;
   }
 
   // If there's alpha, blend with a white background.
-  if (a1 < 255) {
-    const float alpha = a1 / 255.0f;
+  if (a1 < kMax) {
+    const float alpha = a1 / kMax;
     r1 = blend(r1, alpha);
     g1 = blend(g1, alpha);
     b1 = blend(b1, alpha);
   }
 
-  if (a2 < 255) {
-    const float alpha = a2 / 255.0f;
+  if (a2 < kMax) {
+    const float alpha = a2 / kMax;
     r2 = blend(r2, alpha);
     g2 = blend(g2, alpha);
     b2 = blend(b2, alpha);
@@ -95,14 +143,352 @@ float colorDelta(span<const uint8_t> img1, span<const uint8_t> img2, size_t pos1
   return y1 > y2 ? -delta : delta;
 }
 
+/// Color in a Lab-like space: lightness and two opponent color axes.
+struct Lab {
+  float l;
+  float a;
+  float b;
+};
+
+/// sRGB transfer function, from an encoded channel value to linear light (nominally 0 to 1).
+inline float srgbToLinear(float c) noexcept {
+  return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+/// Lookup table of \ref srgbToLinear for every 8-bit channel value.
+const std::array<float, 256>& srgbToLinearTable() noexcept {
+  static const std::array<float, 256> table = []() noexcept {
+    std::array<float, 256> values{};
+    for (size_t i = 0; i < values.size(); ++i) {
+      values[i] = srgbToLinear(static_cast<float>(i) / 255.0f);
+    }
+    return values;
+  }();
+  return table;
+}
+
+/**
+ * Cube root accurate to about 1e-7 relative error, much faster than std::cbrt. Uses an exponent
+ * estimate refined with two Newton-Raphson iterations.
+ */
+inline float fastCbrt(float x) noexcept {
+  if (!(x > 0.0f)) {
+    return x < 0.0f ? -fastCbrt(-x) : 0.0f;
+  }
+
+  uint32_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  bits = bits / 3 + 709921077u;
+  float y;
+  std::memcpy(&y, &bits, sizeof(y));
+
+  y = (2.0f * y + x / (y * y)) * (1.0f / 3.0f);
+  y = (2.0f * y + x / (y * y)) * (1.0f / 3.0f);
+  return y;
+}
+
+/**
+ * Blend a pixel with white like \ref colorDelta, and convert it to linear RGB. 8-bit channels use
+ * a lookup table, since the blend keeps them 8-bit.
+ */
+template <typename T>
+inline void pixelToLinearRgb(span<const T> img, size_t pos, float rgb[3]) noexcept {
+  constexpr float kMax = ChannelTraits<T>::kMax;
+  const T a = img[pos + 3];
+
+  for (size_t c = 0; c < 3; ++c) {
+    const T value = a < kMax ? blend(img[pos + c], a / kMax) : img[pos + c];
+    if constexpr (std::is_same_v<T, uint8_t>) {
+      rgb[c] = srgbToLinearTable()[value];
+    } else {
+      rgb[c] = srgbToLinear(static_cast<float>(value) / kMax);
+    }
+  }
+}
+
+/// Convert linear sRGB to OKLab, see https://bottosson.github.io/posts/oklab/.
+inline Lab linearRgbToOklab(const float rgb[3]) noexcept {
+  const float l =
+      fastCbrt(0.4122214708f * rgb[0] + 0.5363325363f * rgb[1] + 0.0514459929f * rgb[2]);
+  const float m =
+      fastCbrt(0.2119034982f * rgb[0] + 0.6806995451f * rgb[1] + 0.1073969566f * rgb[2]);
+  const float s =
+      fastCbrt(0.0883024619f * rgb[0] + 0.2817188376f * rgb[1] + 0.6299787005f * rgb[2]);
+
+  return {0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s,
+          1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s,
+          0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s};
+}
+
+/// Convert linear sRGB to CIELAB, with the D65 white point of sRGB.
+inline Lab linearRgbToCielab(const float rgb[3]) noexcept {
+  // XYZ normalized by the reference white, which is folded into the coefficients of X and Z.
+  const float x = 0.4339499f * rgb[0] + 0.3762098f * rgb[1] + 0.1898403f * rgb[2];
+  const float y = 0.2126729f * rgb[0] + 0.7151522f * rgb[1] + 0.0721750f * rgb[2];
+  const float z = 0.0177566f * rgb[0] + 0.1094680f * rgb[1] + 0.8727755f * rgb[2];
+
+  const auto f = [](float t) noexcept {
+    constexpr float kEpsilon = 216.0f / 24389.0f;  // (6/29)^3
+    constexpr float kKappa = 24389.0f / 27.0f;     // (29/3)^3
+    return t > kEpsilon ? fastCbrt(t) : (kKappa * t + 16.0f) * (1.0f / 116.0f);
+  };
+
+  const float fx = f(x);
+  const float fy = f(y);
+  const float fz = f(z);
+  return {116.0f * fy - 16.0f, 500.0f * (fx - fy), 200.0f * (fy - fz)};
+}
+
+/**
+ * Arctangent of y / x in [-π, π], like std::atan2, with an absolute error below 1e-5. Uses the
+ * polynomial of Abramowitz and Stegun 4.4.49 on the octant, without branching on the quadrant.
+ */
+inline float fastAtan2(float y, float x) noexcept {
+  constexpr float kPi = 3.14159265358979f;
+  const float absX = std::abs(x);
+  const float absY = std::abs(y);
+  const float ratio = std::min(absX, absY) / std::max(std::max(absX, absY), 1e-30f);
+  const float s = ratio * ratio;
+  float angle =
+      ratio *
+      (0.9998660f + s * (-0.3302995f + s * (0.1801410f + s * (-0.0851330f + s * 0.0208351f))));
+  angle = absY > absX ? 0.5f * kPi - angle : angle;
+  angle = x < 0.0f ? kPi - angle : angle;
+  return std::copysign(angle, y);
+}
+
+/**
+ * Exponential accurate to about 1e-7 relative error for x in [-87, 0], much faster than std::exp.
+ * Splits e^x into 2^i * 2^f with |f| <= 0.5, and evaluates 2^f with its Taylor series.
+ */
+inline float fastExpNegative(float x) noexcept {
+  const float t = std::max(x, -87.0f) * 1.44269504f;  // log2(e)
+  const float i = std::floor(t + 0.5f);
+  const float f = (t - i) * 0.69314718f;  // ln(2)
+  const float expF =
+      1.0f +
+      f * (1.0f + f * (0.5f + f * (1.0f / 6.0f + f * (1.0f / 24.0f + f * (1.0f / 120.0f +
+                                                                          f * (1.0f / 720.0f))))));
+  const uint32_t bits = static_cast<uint32_t>(static_cast<int32_t>(i) + 127) << 23;
+  float scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+  return expF * scale;
+}
+
+/**
+ * Calculate the square of the CIEDE2000 color difference between two CIELAB colors, following
+ * "The CIEDE2000 Color-Difference Formula: Implementation Notes, Supplementary Test Data, and
+ * Mathematical Observations" by G. Sharma, W. Wu and E. N. Dalal, with kL = kC = kH = 1.
+ *
+ * Hue angles are kept as unit vectors, so that the hue difference and the multiple-angle terms of
+ * the hue weighting are computed algebraically. The rotation term uses polynomial approximations
+ * of atan2, exp and sin rather than calls into libm. The cost is dominated by divisions and square
+ * roots, so they are shared where possible, and the result is left squared since callers square
+ * it anyway.
+ */
+inline float ciede2000Squared(const Lab& lab1, const Lab& lab2) noexcept {
+  constexpr float kPi = 3.14159265358979f;
+  constexpr float k25Pow7 = 6103515625.0f;
+  const auto pow7 = [](float v) noexcept {
+    const float v2 = v * v;
+    return v2 * v2 * v2 * v;
+  };
+
+  // Adjust a* to compensate for the low chroma of neutral colors.
+  const float cMean = 0.5f * (std::sqrt(lab1.a * lab1.a + lab1.b * lab1.b) +
+                              std::sqrt(lab2.a * lab2.a + lab2.b * lab2.b));
+  const float g = 0.5f * (1.0f - std::sqrt(pow7(cMean) / (pow7(cMean) + k25Pow7)));
+  const float a1 = lab1.a * (1.0f + g);
+  const float a2 = lab2.a * (1.0f + g);
+
+  const float c1 = std::sqrt(a1 * a1 + lab1.b * lab1.b);
+  const float c2 = std::sqrt(a2 * a2 + lab2.b * lab2.b);
+
+  // Lightness and chroma differences, and the hue difference 2 * sqrt(c1 * c2) * sin(Δh / 2),
+  // whose square is 2 * (c1 * c2 - cos(Δh) * c1 * c2), signed like sin(Δh).
+  const float deltaL = lab2.l - lab1.l;
+  const float deltaC = c2 - c1;
+  const float cross = a1 * lab2.b - lab1.b * a2;
+  const float deltaHue =
+      std::copysign(std::sqrt(std::max(2.0f * (c1 * c2 - a1 * a2 - lab1.b * lab2.b), 0.0f)),
+                    cross);
+
+  // Mean hue, as a unit vector: the bisector of the shorter arc between both hues, or the hue of
+  // the chromatic color if the other is achromatic.
+  float hueX = (c1 > 0.0f ? a1 / c1 : 0.0f) + (c2 > 0.0f ? a2 / c2 : 0.0f);
+  float hueY = (c1 > 0.0f ? lab1.b / c1 : 0.0f) + (c2 > 0.0f ? lab2.b / c2 : 0.0f);
+  float hueNorm = std::sqrt(hueX * hueX + hueY * hueY);
+  if (hueNorm < 1e-6f) {
+    if (c1 > 0.0f && c2 > 0.0f) {
+      // Opposite hues: the mean of both angles in [0, 2π) is 90 degrees past the smaller one.
+      const auto angle = [kPi](float b, float a) noexcept {
+        const float h = std::atan2(b, a);
+        return h < 0.0f ? h + 2.0f * kPi : h;
+      };
+      const float hMean = 0.5f * (angle(lab1.b, a1) + angle(lab2.b, a2));
+      hueX = std::cos(hMean);
+      hueY = std::sin(hMean);
+    } else {
+      hueX = 1.0f;
+      hueY = 0.0f;
+    }
+    hueNorm = 1.0f;
+  }
+  const float invHueNorm = 1.0f / hueNorm;
+  const float cosH = hueX * invHueNorm;
+  const float sinH = hueY * invHueNorm;
+
+  // T = 1 - 0.17 cos(h - 30°) + 0.24 cos(2h) + 0.32 cos(3h + 6°) - 0.20 cos(4h - 63°).
+  const float cos2H = cosH * cosH - sinH * sinH;
+  const float sin2H = 2.0f * sinH * cosH;
+  const float cos3H = (4.0f * cosH * cosH - 3.0f) * cosH;
+  const float sin3H = (3.0f - 4.0f * sinH * sinH) * sinH;
+  const float cos4H = 2.0f * cos2H * cos2H - 1.0f;
+  const float sin4H = 2.0f * sin2H * cos2H;
+  const float t = 1.0f - 0.17f * (0.86602540f * cosH + 0.5f * sinH) + 0.24f * cos2H +
+                  0.32f * (0.99452190f * cos3H - 0.10452846f * sin3H) -
+                  0.20f * (0.45399050f * cos4H + 0.89100652f * sin4H);
+
+  // Rotation term, for the interaction between chroma and hue in the blue region. It decays as
+  // exp(-((h - 275°) / 25°)^2), which is below float precision more than 100° away from 275°. The
+  // angle from 275° is measured on the rotated hue vector, and sin(2Δθ) is a Taylor series since
+  // 2Δθ is at most 60°.
+  const float cMeanPrime = 0.5f * (c1 + c2);
+  float rt = 0.0f;
+  const float cosOffset = 0.08715574f * cosH - 0.99619470f * sinH;  // cos(h - 275°)
+  if (cosOffset > -0.17364818f) {                                     // cos(100°)
+    const float sinOffset = 0.08715574f * sinH + 0.99619470f * cosH;  // sin(h - 275°)
+    const float hueOffset = fastAtan2(sinOffset, cosOffset) * (180.0f / kPi / 25.0f);
+    const float doubleTheta = 60.0f * (kPi / 180.0f) * fastExpNegative(-hueOffset * hueOffset);
+    const float doubleTheta2 = doubleTheta * doubleTheta;
+    const float sinDoubleTheta =
+        doubleTheta *
+        (1.0f - doubleTheta2 * (1.0f / 6.0f) *
+                    (1.0f - doubleTheta2 * (1.0f / 20.0f) *
+                                (1.0f - doubleTheta2 * (1.0f / 42.0f) *
+                                            (1.0f - doubleTheta2 * (1.0f / 72.0f)))));
+    const float rc = 2.0f * std::sqrt(pow7(cMeanPrime) / (pow7(cMeanPrime) + k25Pow7));
+    rt = -sinDoubleTheta * rc;
+  }
+
+  // Weighting functions.
+  const float lMean = 0.5f * (lab1.l + lab2.l);
+  const float lOffset = (lMean - 50.0f) * (lMean - 50.0f);
+  const float sl = 1.0f + 0.015f * lOffset / std::sqrt(20.0f + lOffset);
+  const float sc = 1.0f + 0.045f * cMeanPrime;
+  const float sh = 1.0f + 0.015f * cMeanPrime * t;
+
+  // Divide by the three weights with a single division, since divisions dominate the cost.
+  const float invWeights = 1.0f / (sl * sc * sh);
+  const float l = deltaL * sc * sh * invWeights;
+  const float c = deltaC * sl * sh * invWeights;
+  const float h = deltaHue * sl * sc * invWeights;
+  return std::max(l * l + c * c + h * h + rt * c * h, 0.0f);
+}
+
+/// The last pixel of an image converted by a perceptual metric, see \ref MetricCache.
+template <typename T>
+struct LabCacheEntry {
+  T pixel[kPixelChannels] = {};
+  Lab lab = {};
+  bool valid = false;
+};
+
+/**
+ * State kept by \ref metricDelta across the pixels it is called on, in order. Rendered images
+ * often have runs of identical pixels, so the perceptual metrics reuse the Lab conversion of the
+ * previous pixel of each image when it is the same.
+ */
+template <typename T>
+struct MetricCache {
+  LabCacheEntry<T> img1;
+  LabCacheEntry<T> img2;
+};
+
+/// Convert a pixel to the Lab space of \ref kMetric, reusing \ref entry if it holds the pixel.
+template <ColorMetric kMetric, typename T>
+inline const Lab& pixelToLab(span<const T> img, size_t pos, LabCacheEntry<T>& entry) noexcept {
+  if (entry.valid && std::memcmp(entry.pixel, &img[pos], sizeof(entry.pixel)) == 0) {
+    return entry.lab;
+  }
+
+  float rgb[3];
+  pixelToLinearRgb(img, pos, rgb);
+  std::memcpy(entry.pixel, &img[pos], sizeof(entry.pixel));
+  entry.lab = kMetric == ColorMetric::kOklab ? linearRgbToOklab(rgb) : linearRgbToCielab(rgb);
+  entry.valid = true;
+  return entry.lab;
+}
+
+/**
+ * Calculate the color difference with the metric \ref kMetric. Perceptual metrics are scaled to
+ * the range of \ref colorDelta, so that the threshold is the OKLab distance or ΔE00 / 100, squared
+ * like the YIQ delta.
+ *
+ * @param cache Conversions of the previous pixels, unused by the YIQ metric.
+ * @return The squared delta, with sign indicating whether img2 lightens or darkens the pixel
+ *         (negative if it darkens). Returns 0 if the pixels are identical.
+ */
+template <ColorMetric kMetric, typename T>
+float metricDelta(span<const T> img1, span<const T> img2, size_t pos,
+                  MetricCache<T>& cache) noexcept {
+  if constexpr (kMetric == ColorMetric::kYiq) {
+    (void)cache;
+    return colorDelta(img1, img2, pos, pos, false);
+  } else {
+    if (img1[pos + 0] == img2[pos + 0] && img1[pos + 1] == img2[pos + 1] &&
+        img1[pos + 2] == img2[pos + 2] && img1[pos + 3] == img2[pos + 3]) {
+      return 0;
+    }
+
+    // 35215 is the maximum possible value of the YIQ delta with 8-bit channels, see
+    // maxDeltaForThreshold.
+    constexpr float kChannelScale = ChannelTraits<T>::kMax / 255.0f;
+    constexpr float kScale = 35215.0f * kChannelScale * kChannelScale;
+
+    const Lab& lab1 = pixelToLab<kMetric>(img1, pos, cache.img1);
+    const Lab& lab2 = pixelToLab<kMetric>(img2, pos, cache.img2);
+    float distanceSquared;
+    if constexpr (kMetric == ColorMetric::kOklab) {
+      distanceSquared = (lab1.l - lab2.l) * (lab1.l - lab2.l) +
+                        (lab1.a - lab2.a) * (lab1.a - lab2.a) +
+                        (lab1.b - lab2.b) * (lab1.b - lab2.b);
+    } else {
+      distanceSquared = ciede2000Squared(lab1, lab2) * 1e-4f;  // (ΔE00 / 100)^2
+    }
+
+    const float delta = kScale * distanceSquared;
+    return lab1.l > lab2.l ? -delta : delta;
+  }
+}
+
+/**
+ * Call \ref fn with the color metric as a std::integral_constant, so that the per-pixel code is
+ * instantiated for each metric and the metric is only switched on once per comparison.
+ */
+template <typename Fn>
+decltype(auto) withColorMetric(ColorMetric metric, Fn&& fn) noexcept {
+  switch (metric) {
+    case ColorMetric::kOklab:
+      return fn(std::integral_constant<ColorMetric, ColorMetric::kOklab>());
+    case ColorMetric::kCiede2000:
+      return fn(std::integral_constant<ColorMetric, ColorMetric::kCiede2000>());
+    case ColorMetric::kYiq:
+      break;
+  }
+
+  return fn(std::integral_constant<ColorMetric, ColorMetric::kYiq>());
+}
+
 /// Check if a pixel has 3+ adjacent pixels of the same color.
-bool hasManySiblings(span<const uint8_t> img, int x1, int y1, int width, int height,
+template <typename T>
+bool hasManySiblings(span<const T> img, int x1, int y1, int width, int height,
                      size_t strideInPixels) {
   const int x0 = std::max(x1 - 1, 0);
   const int y0 = std::max(y1 - 1, 0);
   const int x2 = std::min(x1 + 1, width - 1);
   const int y2 = std::min(y1 + 1, height - 1);
-  const size_t pos = (y1 * strideInPixels + x1) * kPixelBytes;
+  const size_t pos = (y1 * strideInPixels + x1) * kPixelChannels;
 
   size_t zeroes = x1 == x0 || x1 == x2 || y1 == y0 || y1 == y2 ? 1 : 0;
 
@@ -113,7 +499,7 @@ bool hasManySiblings(span<const uint8_t> img, int x1, int y1, int width, int hei
         continue;
       }
 
-      const size_t pos2 = (y * strideInPixels + x) * kPixelBytes;
+      const size_t pos2 = (y * strideInPixels + x) * kPixelChannels;
       if (img[pos] == img[pos2] && img[pos + 1] == img[pos2 + 1] && img[pos + 2] == img[pos2 + 2] &&
           img[pos + 3] == img[pos2 + 3]) {
         zeroes++;
@@ -132,13 +518,14 @@ bool hasManySiblings(span<const uint8_t> img, int x1, int y1, int width, int hei
  * Check if a pixel is likely a part of anti-aliasing;
  * based on "Anti-aliased Pixel and Intensity Slope Detector" paper by V. Vysniauskas, 2009
  */
-bool antialiased(span<const uint8_t> img, int x1, int y1, int width, int height,
-                 size_t strideInPixels, span<const uint8_t> img2) noexcept {
+template <typename T>
+bool antialiased(span<const T> img, int x1, int y1, int width, int height, size_t strideInPixels,
+                 span<const T> img2) noexcept {
   const int x0 = std::max(x1 - 1, 0);
   const int y0 = std::max(y1 - 1, 0);
   const int x2 = std::min(x1 + 1, width - 1);
   const int y2 = std::min(y1 + 1, height - 1);
-  const size_t pos = (y1 * strideInPixels + x1) * kPixelBytes;
+  const size_t pos = (y1 * strideInPixels + x1) * kPixelChannels;
 
   size_t zeroes = x1 == x0 || x1 == x2 || y1 == y0 || y1 == y2 ? 1 : 0;
   float minDelta = 0.0f;
@@ -156,7 +543,7 @@ bool antialiased(span<const uint8_t> img, int x1, int y1, int width, int height,
       }
 
       // Brightness delta between the center pixel and adjacent one.
-      const float delta = colorDelta(img, img, pos, (y * strideInPixels + x) * kPixelBytes, true);
+      const float delta = colorDelta(img, img, pos, (y * strideInPixels + x) * kPixelChannels, true);
 
       // Count the number of equal, darker and brighter adjacent pixels.
       if (delta == 0) {
@@ -194,120 +581,1600 @@ bool antialiased(span<const uint8_t> img, int x1, int y1, int width, int height,
           hasManySiblings(img2, maxX, maxY, width, height, strideInPixels));
 }
 
-inline void drawPixel(span<uint8_t> output, size_t pos, Color color) noexcept {
-  output[pos + 0] = color.r;
-  output[pos + 1] = color.g;
-  output[pos + 2] = color.b;
-  output[pos + 3] = color.a;
+template <typename T>
+inline void drawPixel(span<T> output, size_t pos, Color color) noexcept {
+  output[pos + 0] = fromColorChannel<T>(color.r);
+  output[pos + 1] = fromColorChannel<T>(color.g);
+  output[pos + 2] = fromColorChannel<T>(color.b);
+  output[pos + 3] = fromColorChannel<T>(color.a);
 }
 
-void drawGrayPixel(span<const uint8_t> img, size_t pos, float alpha, span<uint8_t> output) noexcept {
-  const uint8_t r = img[pos + 0];
-  const uint8_t g = img[pos + 1];
-  const uint8_t b = img[pos + 2];
-  const uint8_t val = blend(rgb2y(r, g, b), alpha * static_cast<float>(img[pos + 3]) / 255.0f);
-  drawPixel(output, pos, Color{val, val, val, 255});
+/// Draw the pixel of \ref img at \ref pos as gray, to \ref output at \ref outputPos.
+template <typename T>
+inline void drawGrayPixel(span<const T> img, size_t pos, float alpha, span<T> output,
+                          size_t outputPos) noexcept {
+  constexpr float kMax = ChannelTraits<T>::kMax;
+
+  const T r = img[pos + 0];
+  const T g = img[pos + 1];
+  const T b = img[pos + 2];
+  const T val =
+      blend(static_cast<T>(rgb2y(r, g, b)), alpha * static_cast<float>(img[pos + 3]) / kMax);
+  output[outputPos + 0] = val;
+  output[outputPos + 1] = val;
+  output[outputPos + 2] = val;
+  output[outputPos + 3] = static_cast<T>(kMax);
 }
 
-}  // namespace
+template <typename T>
+inline void drawGrayPixel(span<const T> img, size_t pos, float alpha, span<T> output) noexcept {
+  drawGrayPixel(img, pos, alpha, output, pos);
+}
 
-int pixelmatch(span<const uint8_t> img1, span<const uint8_t> img2, span<uint8_t> output, int width,
-               int height, size_t strideInPixels, Options options) noexcept {
-  // In release builds, return -1 if a precondition fails since the asserts will not trigger.
+/// Default heatmap ramp, from just over the threshold to the maximum difference.
+constexpr Color kDefaultHeatmapColors[] = {
+    {0, 0, 255, 255},    // Blue.
+    {255, 0, 255, 255},  // Magenta.
+    {255, 0, 0, 255},    // Red.
+};
+
+/**
+ * Interpolate the heatmap color ramp.
+ *
+ * @param colors The ramp, or an empty span to use \ref kDefaultHeatmapColors.
+ * @param t Position on the ramp, between 0 and 1.
+ */
+Color heatmapColor(span<const Color> colors, float t) noexcept {
+  if (colors.empty()) {
+    colors = span<const Color>(kDefaultHeatmapColors, std::size(kDefaultHeatmapColors));
+  }
+
+  const float position = std::clamp(t, 0.0f, 1.0f) * static_cast<float>(colors.size() - 1);
+  const size_t index = std::min(static_cast<size_t>(position), colors.size() - 1);
+  const size_t next = std::min(index + 1, colors.size() - 1);
+  const float fraction = position - static_cast<float>(index);
+
+  const Color from = colors[index];
+  const Color to = colors[next];
+  const auto lerp = [fraction](uint8_t a, uint8_t b) {
+    return static_cast<uint8_t>(std::lround(a + (b - a) * fraction));
+  };
+  return Color{lerp(from.r, to.r), lerp(from.g, to.g), lerp(from.b, to.b), lerp(from.a, to.a)};
+}
+
+/// Convert a delta normalized to the 0 to 1 range to the delta plane representation.
+template <typename D>
+inline D encodeDelta(float normalized) noexcept {
+  if constexpr (std::is_floating_point_v<D>) {
+    return normalized;
+  } else {
+    return static_cast<D>(std::lround(std::min(normalized, 1.0f) * 65535.0f));
+  }
+}
+
+/// Classification of a single pixel by the comparison.
+enum class PixelKind {
+  kSimilar,      //!< The pixel is within the threshold.
+  kAntialiased,  //!< The pixel is above the threshold, but detected as anti-aliasing.
+  kDifferent,    //!< The pixel is above the threshold and counts as a difference.
+};
+
+/**
+ * Compare a single pixel between both images.
+ *
+ * @param delta Set to the signed color delta for the pixel, see \ref colorDelta.
+ */
+template <ColorMetric kMetric, typename T>
+PixelKind classifyPixel(span<const T> img1, span<const T> img2, int x, int y, int width,
+                        int height, size_t strideInPixels, float maxDelta, bool includeAA,
+                        MetricCache<T>& cache, float& delta) noexcept {
+  const size_t pos = (y * strideInPixels + x) * kPixelChannels;
+
+  // Most pixels of typical inputs are identical, so check for that inline with a single compare
+  // before calling into the color metric.
+  if (std::memcmp(&img1[pos], &img2[pos], kPixelChannels * sizeof(T)) == 0) {
+    delta = 0.0f;
+    return PixelKind::kSimilar;
+  }
+
+  // Squared distance between colors at this pixel position, negative if the img2 pixel is
+  // darker.
+  delta = metricDelta<kMetric>(img1, img2, pos, cache);
+
+  // The color difference is above the threshold.
+  if (std::abs(delta) > maxDelta) {
+    // Check it's a real rendering difference or just anti-aliasing.
+    if (!includeAA && (antialiased(img1, x, y, width, height, strideInPixels, img2) ||
+                       antialiased(img2, x, y, width, height, strideInPixels, img1))) {
+      return PixelKind::kAntialiased;
+    }
+
+    return PixelKind::kDifferent;
+  }
+
+  return PixelKind::kSimilar;
+}
+
+/**
+ * Validate the dimensions and buffer size of a single image, asserting on debug builds.
+ *
+ * @return true if the image is valid.
+ */
+template <typename T>
+bool validateImage(span<const T> img, int width, int height, size_t strideInPixels) noexcept {
   if (width <= 0 || height <= 0 || strideInPixels < static_cast<size_t>(width)) {
     assert(width > 0);
     assert(height > 0);
     assert(strideInPixels >= static_cast<size_t>(width) && "Stride must be greater than width");
-    return -1;
+    return false;
   }
 
-  if (img1.size() != strideInPixels * height * kPixelBytes || img1.size() != img2.size()) {
-    assert(img1.size() == strideInPixels * height * kPixelBytes &&
+  if (img.size() != strideInPixels * height * kPixelChannels) {
+    assert(img.size() == strideInPixels * height * kPixelChannels &&
            "Image data size does not match width/height");
-    assert(img2.size() == strideInPixels * height * kPixelBytes &&
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Validate the preconditions shared by the comparison functions, asserting on debug builds.
+ *
+ * @return true if the inputs are valid.
+ */
+template <typename T>
+bool validateInputs(span<const T> img1, span<const T> img2, int width, int height,
+                    size_t strideInPixels) noexcept {
+  if (!validateImage(img1, width, height, strideInPixels)) {
+    return false;
+  }
+
+  if (img2.size() != img1.size()) {
+    assert(img2.size() == strideInPixels * height * kPixelChannels &&
            "Image data size does not match width/height");
-    return -1;
+    return false;
   }
 
-  if (output.size() != img1.size() && !output.empty()) {
-    assert(img1.size() == output.size() || output.empty());
-    return -1;
+  return true;
+}
+
+/// Maximum acceptable square distance between two colors for the given threshold.
+template <typename T>
+inline float maxDeltaForThreshold(float threshold) noexcept {
+  // 35215 is the maximum possible value for the YIQ difference metric with 8-bit channels, scale
+  // it to the range of the channel type.
+  constexpr float kScale = ChannelTraits<T>::kMax / 255.0f;
+  return 35215.0f * kScale * kScale * threshold * threshold;
+}
+
+/// Deterministically hash a cell coordinate, used to jitter sample positions.
+inline uint32_t hashCell(uint32_t x, uint32_t y) noexcept {
+  uint32_t h = x * 0x9E3779B1u ^ (y + 0x7F4A7C15u) * 0x85EBCA77u;
+  h ^= h >> 15;
+  h *= 0x2C1B3C6Du;
+  h ^= h >> 12;
+  return h;
+}
+
+/// Append a pixel to \ref runs, extending the last run if the pixel continues it. May throw.
+inline void appendRun(std::vector<DiffRun>& runs, int x, int y, DiffRunKind kind) {
+  if (!runs.empty()) {
+    DiffRun& last = runs.back();
+    if (last.y == y && last.kind == kind && last.x + last.length == x) {
+      ++last.length;
+      return;
+    }
   }
 
-  // Check for identical images, respecting stride.
-  bool identical = true;
+  runs.push_back(DiffRun{x, y, 1, kind});
+}
+
+/// Check for identical images, respecting stride.
+template <typename T>
+bool imagesIdentical(span<const T> img1, span<const T> img2, int width, int height,
+                     size_t strideInPixels) noexcept {
   for (int y = 0; y < height; ++y) {
     const size_t rowStartIndex = y * strideInPixels;
-    if (std::memcmp(&img1[rowStartIndex * kPixelBytes], &img2[rowStartIndex * kPixelBytes],
-                    width * 4) != 0) {
-      identical = false;
-      break;
+    if (std::memcmp(&img1[rowStartIndex * kPixelChannels], &img2[rowStartIndex * kPixelChannels],
+                    width * kPixelChannels * sizeof(T)) != 0) {
+      return false;
     }
   }
 
-  // Fast path if identical.
-  if (identical) {
-    // Update output image, filling with gray pixels.
-    if (!output.empty() && !options.diffMask) {
-      for (int y = 0; y < height; ++y) {
-        const size_t rowStartIndex = y * strideInPixels;
-        for (int x = 0; x < width; ++x) {
-          const size_t pos = (rowStartIndex + x) * kPixelBytes;
-          drawGrayPixel(img1, pos, options.alpha, output);
+  return true;
+}
+
+/// Returns a view of \ref img starting at pixel (x, y), or an empty span if \ref img is empty.
+template <typename T>
+span<T> subview(span<T> img, int x, int y, size_t strideInPixels) noexcept {
+  if (img.empty()) {
+    return img;
+  }
+
+  const size_t offset = (y * strideInPixels + x) * kPixelChannels;
+  return span<T>(&img[offset], img.size() - offset);
+}
+
+/**
+ * Inputs of a comparison shared by the bands of rows of \ref compareRegion, see
+ * \ref compareRegion for a description of each field.
+ */
+template <typename T, typename D>
+struct RegionComparison {
+  span<const T> img1;
+  span<const T> img2;
+  span<T> output;
+  span<D> deltas;
+  int width;
+  int height;
+  size_t strideInPixels;
+  const Options* options;
+  std::atomic<bool>* runsFailed;  //!< Set if appending to the runs fails.
+};
+
+/**
+ * Images read by \ref compareRows: either the images of the region itself, or copies of a tile of
+ * them with its halo. The pixel at (x, y) of the region is at (x - originX, y - originY) of the
+ * source, which must contain every pixel that anti-aliasing detection reads around the compared
+ * pixels, or end where the region ends.
+ */
+template <typename T>
+struct PixelSource {
+  span<const T> img1;
+  span<const T> img2;
+  int width;
+  int height;
+  size_t strideInPixels;
+  int originX;
+  int originY;
+};
+
+/**
+ * Compare the pixels in [startX, endX) x [startY, endY) of a region and draw them, see
+ * \ref compareRegion.
+ *
+ * The loop is specialized on the color metric, and on whether any per-pixel extra is requested, so
+ * that the common case of only counting and drawing the diff does not pay for the checks of the
+ * delta plane, heatmap and runs on every pixel. The inputs are copied to locals, since the compiler
+ * cannot keep values reached through pointers in registers across the byte stores to the output.
+ *
+ * @tparam kMetric The color metric of the options.
+ * @tparam kExtras Whether the delta plane, heatmap or runs are used.
+ * @param source The images to read the pixels from, the output and delta plane are always written
+ *               in region coordinates.
+ * @param runs If not null, the different and anti-aliased pixels are appended to it as runs.
+ * @return The number of different pixels.
+ */
+template <ColorMetric kMetric, bool kExtras, typename T, typename D>
+int compareRows(const RegionComparison<T, D>& region, const PixelSource<T>& source, int startX,
+                int endX, int startY, int endY, std::vector<DiffRun>* runs) noexcept {
+  const span<const T> img1 = source.img1;
+  const span<const T> img2 = source.img2;
+  span<T> output = region.output;
+  span<D> deltas = region.deltas;
+  const int sourceWidth = source.width;
+  const int sourceHeight = source.height;
+  const size_t sourceStrideInPixels = source.strideInPixels;
+  const size_t strideInPixels = region.strideInPixels;
+  const Options& options = *region.options;
+
+  const float maxDelta = maxDeltaForThreshold<T>(options.threshold);
+  const bool includeAA = options.includeAA;
+  const bool drawOutput = !output.empty();
+  const bool diffMask = options.diffMask;
+  const float alpha = options.alpha;
+  const Color aaColor = options.aaColor;
+  const Color diffColor = options.diffColor;
+  const Color diffColorAlt = options.diffColorAlt.value_or(options.diffColor);
+
+  MetricCache<T> cache;
+  int diff = 0;
+  for (int y = startY; y < endY; ++y) {
+    const size_t rowStartIndex = y * strideInPixels;
+    const int sourceY = y - source.originY;
+
+    for (int x = startX; x < endX; ++x) {
+      const size_t index = rowStartIndex + x;
+      const size_t pos = index * kPixelChannels;
+      const int sourceX = x - source.originX;
+
+      float delta;
+      const PixelKind kind =
+          classifyPixel<kMetric>(img1, img2, sourceX, sourceY, sourceWidth, sourceHeight,
+                                 sourceStrideInPixels, maxDelta, includeAA, cache, delta);
+
+      // Express the delta as the threshold it corresponds to, so that 0 to 1 maps to the
+      // threshold range.
+      float normalizedDelta = 0.0f;
+      if constexpr (kExtras) {
+        if (!deltas.empty() || options.heatmap) {
+          normalizedDelta = std::sqrt(std::abs(delta) / maxDeltaForThreshold<T>(1.0f));
+        }
+
+        if (!deltas.empty()) {
+          deltas[index] = encodeDelta<D>(normalizedDelta);
+        }
+
+        if (runs != nullptr && kind != PixelKind::kSimilar) {
+          const DiffRunKind runKind = kind == PixelKind::kAntialiased ? DiffRunKind::kAntialiased
+                                      : delta < 0.0f                  ? DiffRunKind::kDiffAlt
+                                                                      : DiffRunKind::kDiff;
+          try {
+            appendRun(*runs, x, y, runKind);
+          } catch (...) {
+            region.runsFailed->store(true, std::memory_order_relaxed);
+          }
+        }
+      }
+
+      if (kind == PixelKind::kAntialiased) {
+        // One of the pixels is anti-aliasing; draw as yellow and do not count as difference
+        // note that we do not include such pixels in a mask.
+        if (drawOutput && !diffMask) {
+          drawPixel(output, pos, aaColor);
+        }
+      } else if (kind == PixelKind::kDifferent) {
+        // Found substantial difference not caused by anti-aliasing; draw it as such.
+        if (drawOutput) {
+          if constexpr (kExtras) {
+            if (options.heatmap) {
+              const float overThreshold = options.threshold < 1.0f
+                                              ? (normalizedDelta - options.threshold) /
+                                                    (1.0f - options.threshold)
+                                              : 1.0f;
+              drawPixel(output, pos, heatmapColor(options.heatmapColors, overThreshold));
+              ++diff;
+              continue;
+            }
+          }
+
+          drawPixel(output, pos, delta < 0.0f ? diffColorAlt : diffColor);
         }
+        ++diff;
+      } else if (drawOutput && !diffMask) {
+        // Pixels are similar; draw background as grayscale image blended with white.
+        drawGrayPixel(img1, (sourceY * sourceStrideInPixels + sourceX) * kPixelChannels, alpha,
+                      output, pos);
       }
     }
+  }
 
-    return 0;
+  return diff;
+}
+
+/// Pointer to an instantiation of \ref compareRows.
+template <typename T, typename D>
+using CompareRowsFunction = int (*)(const RegionComparison<T, D>&, const PixelSource<T>&, int,
+                                    int, int, int, std::vector<DiffRun>*) noexcept;
+
+/// Distance from a compared pixel up to which anti-aliasing detection reads other pixels: one for
+/// its neighbors in \ref antialiased, and one more for their siblings in \ref hasManySiblings.
+constexpr int kTileHalo = 2;
+
+/**
+ * Sort the runs of a row of tiles into row order and join the runs that continue each other across
+ * tile boundaries. Does not allocate.
+ */
+inline void sortTileRuns(std::vector<DiffRun>& runs, size_t first) noexcept {
+  std::sort(runs.begin() + first, runs.end(), [](const DiffRun& a, const DiffRun& b) noexcept {
+    return a.y != b.y ? a.y < b.y : a.x < b.x;
+  });
+
+  size_t last = first;
+  for (size_t i = first + 1; i < runs.size(); ++i) {
+    DiffRun& previous = runs[last];
+    if (runs[i].y == previous.y && runs[i].kind == previous.kind &&
+        runs[i].x == previous.x + previous.length) {
+      previous.length += runs[i].length;
+    } else {
+      runs[++last] = runs[i];
+    }
+  }
+
+  if (first < runs.size()) {
+    runs.erase(runs.begin() + last + 1, runs.end());
+  }
+}
+
+/**
+ * Compare the rows in [startY, endY) of a region tile by tile, see \ref Options::tileSize.
+ *
+ * Each row of tiles is first scanned in row order for the rows of each tile that differ between
+ * both images. Identical pixels never read their neighborhood, so the identical rows of the tiles
+ * are compared in row order, which streams through memory. Each tile that differs is then copied
+ * with a halo of \ref kTileHalo pixels into a small contiguous buffer per image, from which
+ * anti-aliasing detection reads the neighborhoods of the tile's pixels. These buffers stay in cache
+ * for the whole tile, while the rows of wide images get evicted between the rows of a neighborhood.
+ *
+ * @return The number of different pixels.
+ */
+template <typename T, typename D>
+int compareTiles(const RegionComparison<T, D>& region, CompareRowsFunction<T, D> compareRows,
+                 int startY, int endY, std::vector<DiffRun>* runs) noexcept {
+  const int width = region.width;
+  const int height = region.height;
+  const size_t strideInPixels = region.strideInPixels;
+  const PixelSource<T> regionSource{region.img1, region.img2,    width, height,
+                                    strideInPixels, /*originX=*/0, /*originY=*/0};
+
+  const int tileWidth = std::min(region.options->tileSize, width);
+  const int tileHeight = std::min(region.options->tileSize, endY - startY);
+  const size_t tileCount = static_cast<size_t>((width - 1) / tileWidth + 1);
+  const size_t haloStrideInPixels = static_cast<size_t>(tileWidth) + 2 * kTileHalo;
+  std::vector<T> halo1;
+  std::vector<T> halo2;
+  std::vector<uint8_t> rowDiffers;  // For each row of the row of tiles, whether each tile differs.
+  try {
+    const size_t haloSize = haloStrideInPixels * (tileHeight + 2 * kTileHalo) * kPixelChannels;
+    halo1.resize(haloSize);
+    halo2.resize(haloSize);
+    rowDiffers.resize(tileCount * tileHeight);
+  } catch (...) {
+    return compareRows(region, regionSource, 0, width, startY, endY, runs);
   }
 
-  // Maximum acceptable square distance between two colors;
-  // 35215 is the maximum possible value for the YIQ difference metric
-  const float kMaxDelta = 35215.0f * options.threshold * options.threshold;
+  const auto tileStartX = [tileWidth](size_t tile) noexcept {
+    return static_cast<int>(tile) * tileWidth;
+  };
+  const auto tileEndX = [tileWidth, width](size_t tile) noexcept {
+    return std::min(static_cast<int>(tile) * tileWidth, width - tileWidth) + tileWidth;
+  };
+
   int diff = 0;
+  for (int tileY = startY; tileY < endY; tileY += tileHeight) {
+    const int tileEndY = std::min(tileY + tileHeight, endY);
+    const auto differs = [&rowDiffers, tileCount, tileY](int y, size_t tile) noexcept -> uint8_t& {
+      return rowDiffers[(y - tileY) * tileCount + tile];
+    };
 
-  // Compare each pixel of one image against the other one.
-  for (int y = 0; y < height; ++y) {
-    const size_t rowStartIndex = y * strideInPixels;
+    // Compare the identical rows of consecutive tiles at once.
+    for (int y = tileY; y < tileEndY; ++y) {
+      const size_t rowStartIndex = y * strideInPixels;
+      for (size_t tile = 0; tile < tileCount; ++tile) {
+        const size_t pos = (rowStartIndex + tileStartX(tile)) * kPixelChannels;
+        const size_t size = (tileEndX(tile) - tileStartX(tile)) * kPixelChannels * sizeof(T);
+        differs(y, tile) = std::memcmp(region.img1.data() + pos, region.img2.data() + pos, size) != 0;
+      }
 
-    for (int x = 0; x < width; ++x) {
-      const size_t pos = (rowStartIndex + x) * kPixelBytes;
-
-      // Squared YUV distance between colors at this pixel position, negative if the img2 pixel is
-      // darker.
-      const float delta = colorDelta(img1, img2, pos, pos, false);
-
-      // The color difference is above the threshold.
-      if (std::abs(delta) > kMaxDelta) {
-        // Check it's a real rendering difference or just anti-aliasing.
-        if (!options.includeAA && (antialiased(img1, x, y, width, height, strideInPixels, img2) ||
-                                   antialiased(img2, x, y, width, height, strideInPixels, img1))) {
-          // One of the pixels is anti-aliasing; draw as yellow and do not count as difference
-          // note that we do not include such pixels in a mask.
-          if (!output.empty() && !options.diffMask) {
-            drawPixel(output, pos, options.aaColor);
-          }
-        } else {
-          // Found substantial difference not caused by anti-aliasing; draw it as such.
-          if (!output.empty()) {
-            drawPixel(output, pos,
-                      delta < 0.0f && options.diffColorAlt ? options.diffColorAlt.value()
-                                                           : options.diffColor);
-          }
-          diff++;
+      for (size_t tile = 0; tile < tileCount;) {
+        if (differs(y, tile)) {
+          ++tile;
+          continue;
         }
 
-      } else if (!output.empty()) {
-        // Pixels are similar; draw background as grayscale image blended with white.
-        if (!options.diffMask) {
-          drawGrayPixel(img1, pos, options.alpha, output);
+        const size_t firstTile = tile;
+        while (tile < tileCount && !differs(y, tile)) {
+          ++tile;
         }
+        diff += compareRows(region, regionSource, tileStartX(firstTile), tileEndX(tile - 1), y,
+                            y + 1, runs);
       }
     }
+
+    const size_t firstRun = runs != nullptr ? runs->size() : 0;
+    for (size_t tile = 0; tile < tileCount; ++tile) {
+      int firstY = tileEndY;
+      int lastY = tileY;
+      for (int y = tileY; y < tileEndY; ++y) {
+        if (differs(y, tile)) {
+          firstY = std::min(firstY, y);
+          lastY = y;
+        }
+      }
+      if (firstY == tileEndY) {
+        continue;
+      }
+
+      // Copy the rows that differ with their halo. The halo is clipped to the region, so the edges
+      // of the buffer are the edges of the region wherever a neighborhood would go past them, as
+      // anti-aliasing detection expects.
+      const int haloX = std::max(tileStartX(tile) - kTileHalo, 0);
+      const int haloEndX = std::min(tileEndX(tile) + kTileHalo, width);
+      const int haloY = std::max(firstY - kTileHalo, 0);
+      const int haloEndY = std::min(lastY + 1 + kTileHalo, height);
+      const size_t rowSize = static_cast<size_t>(haloEndX - haloX) * kPixelChannels * sizeof(T);
+      for (int y = haloY; y < haloEndY; ++y) {
+        const size_t pos = (y * strideInPixels + haloX) * kPixelChannels;
+        const size_t haloPos = (y - haloY) * haloStrideInPixels * kPixelChannels;
+        std::memcpy(&halo1[haloPos], region.img1.data() + pos, rowSize);
+        std::memcpy(&halo2[haloPos], region.img2.data() + pos, rowSize);
+      }
+
+      const PixelSource<T> haloSource{halo1,    halo2,          haloEndX - haloX,
+                                      haloEndY - haloY, haloStrideInPixels, haloX, haloY};
+      for (int y = firstY; y <= lastY;) {
+        if (!differs(y, tile)) {
+          ++y;
+          continue;
+        }
+
+        const int rowsStartY = y;
+        while (y <= lastY && differs(y, tile)) {
+          ++y;
+        }
+        diff += compareRows(region, haloSource, tileStartX(tile), tileEndX(tile), rowsStartY, y,
+                            runs);
+      }
+    }
+
+    if (runs != nullptr) {
+      sortTileRuns(*runs, firstRun);
+    }
   }
 
-  // Return the number of different pixels.
   return diff;
 }
 
+/**
+ * Compare every pixel of a region of two images and draw the result, without validating the
+ * inputs. The region may be a sub-rectangle of larger images, in which case the spans start at the
+ * top-left pixel of the region and \ref strideInPixels is the stride of the larger images.
+ *
+ * @param runs If not null, the different and anti-aliased pixels are appended to it as runs, in
+ *             row order.
+ * @return The number of different pixels, or -1 if the runs could not be allocated.
+ */
+template <typename T, typename D = float>
+int compareRegion(span<const T> img1, span<const T> img2, span<T> output, int width, int height,
+                  size_t strideInPixels, const Options& options, span<D> deltas = span<D>(),
+                  std::vector<DiffRun>* runs = nullptr) noexcept {
+  std::atomic<bool> runsFailed{false};
+  const RegionComparison<T, D> region{img1,  img2,   output,         deltas,  width,
+                                      height, strideInPixels, &options, &runsFailed};
+  const PixelSource<T> regionSource{img1,           img2,          width,        height,
+                                    strideInPixels, /*originX=*/0, /*originY=*/0};
+
+  // Choose the loop once for the whole comparison, rather than checking the options per pixel.
+  // Calling it through a pointer also keeps each loop a separate function, so that the compiler
+  // inlines the per-pixel helpers into each of them.
+  const bool extras = !deltas.empty() || options.heatmap || runs != nullptr;
+  const CompareRowsFunction<T, D> compareRowsFunction = withColorMetric(
+      options.colorMetric, [extras](auto metric) noexcept -> CompareRowsFunction<T, D> {
+        constexpr ColorMetric kMetric = decltype(metric)::value;
+        return extras ? &compareRows<kMetric, true, T, D> : &compareRows<kMetric, false, T, D>;
+      });
+  const bool tiled = options.tileSize > 0;
+  const auto compareBand = [&region, &regionSource, compareRowsFunction, tiled, width](
+                               int startY, int endY, std::vector<DiffRun>* bandRuns) noexcept {
+    if (tiled) {
+      return compareTiles(region, compareRowsFunction, startY, endY, bandRuns);
+    }
+
+    return compareRowsFunction(region, regionSource, 0, width, startY, endY, bandRuns);
+  };
+
+  // Each pixel only writes to its own output, so bands of rows can be compared in parallel. With
+  // tiles, each band is a row of tiles.
+  const int bandRows = tiled ? std::min(options.tileSize, height) : 64;
+  const auto compareSerially = [&]() noexcept {
+    const int diff = compareBand(0, height, runs);
+    return runsFailed ? -1 : diff;
+  };
+
+  if (options.executor == nullptr || height <= bandRows) {
+    return compareSerially();
+  }
+
+  const size_t bandCount = static_cast<size_t>((height - 1) / bandRows + 1);
+  std::vector<int> bandDiffs;
+  std::vector<std::vector<DiffRun>> bandRuns;
+  try {
+    bandDiffs.resize(bandCount);
+    bandRuns.resize(runs != nullptr ? bandCount : 0);
+  } catch (...) {
+    return compareSerially();
+  }
+
+  options.executor->parallelFor(0, bandCount, [&](size_t band) noexcept {
+    const int startY = static_cast<int>(band) * bandRows;
+    bandDiffs[band] = compareBand(startY, std::min(startY + bandRows, height),
+                                  runs != nullptr ? &bandRuns[band] : nullptr);
+  });
+
+  // Bands cover consecutive rows, so concatenating their runs keeps them in row order.
+  try {
+    for (const std::vector<DiffRun>& band : bandRuns) {
+      runs->insert(runs->end(), band.begin(), band.end());
+    }
+  } catch (...) {
+    return -1;
+  }
+
+  if (runsFailed) {
+    return -1;
+  }
+
+  // Return the number of different pixels.
+  return std::accumulate(bandDiffs.begin(), bandDiffs.end(), 0);
+}
+
+template <typename T, typename D = float>
+int pixelmatchImpl(span<const T> img1, span<const T> img2, span<T> output, int width, int height,
+                   size_t strideInPixels, const Options& options, span<D> deltas = span<D>(),
+                   std::vector<DiffRun>* runs = nullptr) noexcept {
+  // In release builds, return -1 if a precondition fails since the asserts will not trigger.
+  if (!validateInputs(img1, img2, width, height, strideInPixels)) {
+    return -1;
+  }
+
+  if (output.size() != img1.size() && !output.empty()) {
+    assert(img1.size() == output.size() || output.empty());
+    return -1;
+  }
+
+  if (deltas.size() != img1.size() / kPixelChannels && !deltas.empty()) {
+    assert(deltas.size() == img1.size() / kPixelChannels || deltas.empty());
+    return -1;
+  }
+
+  if (runs != nullptr) {
+    runs->clear();
+  }
+
+  // Fast path if identical.
+  if (imagesIdentical(img1, img2, width, height, strideInPixels)) {
+    // Update output image, filling with gray pixels.
+    if (!output.empty() && !options.diffMask) {
+      for (int y = 0; y < height; ++y) {
+        const size_t rowStartIndex = y * strideInPixels;
+        for (int x = 0; x < width; ++x) {
+          const size_t pos = (rowStartIndex + x) * kPixelChannels;
+          drawGrayPixel(img1, pos, options.alpha, output);
+        }
+      }
+    }
+
+    for (int y = 0; y < height && !deltas.empty(); ++y) {
+      std::fill_n(&deltas[y * strideInPixels], width, D(0));
+    }
+
+    return 0;
+  }
+
+  return compareRegion(img1, img2, output, width, height, strideInPixels, options, deltas, runs);
+}
+
+/**
+ * Compare img1 against img2 shifted by \ref translation, drawing to \ref output in img1
+ * coordinates. Pixels of img1 which have no counterpart in img2 after shifting are different.
+ *
+ * @return The number of different pixels, or -1 on failure.
+ */
+int compareShifted(span<const uint8_t> img1, span<const uint8_t> img2, span<uint8_t> output,
+                   int width, int height, size_t strideInPixels, Translation translation,
+                   const Options& options) noexcept {
+  const int dx = translation.dx;
+  const int dy = translation.dy;
+
+  // Overlapping region, in img1 coordinates.
+  const int x0 = std::max(0, -dx);
+  const int y0 = std::max(0, -dy);
+  const int x1 = std::min(width, width - dx);
+  const int y1 = std::min(height, height - dy);
+
+  // Pixels of img1 that have no counterpart in img2 after shifting are differences.
+  int diff = 0;
+  for (int y = 0; y < height; ++y) {
+    const bool rowOverlaps = y >= y0 && y < y1;
+    for (int x = 0; x < width; ++x) {
+      if (rowOverlaps && x == x0) {
+        // Skip over the overlapping region.
+        x = x1 - 1;
+        continue;
+      }
+
+      ++diff;
+      if (!output.empty()) {
+        drawPixel(output, (y * strideInPixels + x) * kPixelChannels, options.diffColor);
+      }
+    }
+  }
+
+  const int overlapDiff = compareRegion(subview(img1, x0, y0, strideInPixels),
+                                        subview(img2, x0 + dx, y0 + dy, strideInPixels),
+                                        subview(output, x0, y0, strideInPixels), x1 - x0,
+                                        y1 - y0, strideInPixels, options);
+  return overlapDiff < 0 ? -1 : diff + overlapDiff;
+}
+
+/**
+ * Compute the mean brightness of each row and each column of an image, after blending with white.
+ */
+void brightnessProfiles(span<const uint8_t> img, int width, int height, size_t strideInPixels,
+                        std::vector<float>& rows, std::vector<float>& columns) {
+  rows.assign(height, 0.0f);
+  columns.assign(width, 0.0f);
+
+  for (int y = 0; y < height; ++y) {
+    float rowSum = 0.0f;
+    for (int x = 0; x < width; ++x) {
+      const size_t pos = (y * strideInPixels + x) * kPixelChannels;
+      const float alpha = img[pos + 3] / 255.0f;
+      const float luma = rgb2y(blend(img[pos + 0], alpha), blend(img[pos + 1], alpha),
+                               blend(img[pos + 2], alpha));
+      rowSum += luma;
+      columns[x] += luma;
+    }
+
+    rows[y] = rowSum / width;
+  }
+
+  for (float& column : columns) {
+    column /= height;
+  }
+}
+
+/**
+ * Find the shift of \ref profile2 relative to \ref profile1 that minimizes the mean absolute
+ * difference of the overlapping entries, preferring smaller shifts on ties.
+ */
+int bestProfileShift(const std::vector<float>& profile1, const std::vector<float>& profile2,
+                     int maxShift) noexcept {
+  const int size = static_cast<int>(profile1.size());
+  maxShift = std::min(maxShift, size - 1);
+
+  int bestShift = 0;
+  float bestCost = 0.0f;
+  for (int distance = 0; distance <= maxShift; ++distance) {
+    for (int shift : {distance, -distance}) {
+      float cost = 0.0f;
+      for (int i = std::max(0, -shift); i < std::min(size, size - shift); ++i) {
+        cost += std::abs(profile1[i] - profile2[i + shift]);
+      }
+      cost /= static_cast<float>(size - distance);
+
+      if (distance == 0 || cost < bestCost) {
+        bestShift = shift;
+        bestCost = cost;
+      }
+
+      if (distance == 0) {
+        break;
+      }
+    }
+  }
+
+  return bestShift;
+}
+
+/// YIQ planes of an image blended with white, stored planar so that rows can be vectorized.
+struct YiqPlanes {
+  int width = 0;
+  int height = 0;
+  std::vector<float> y;
+  std::vector<float> i;
+  std::vector<float> q;
+};
+
+/// Convert an RGBA image to YIQ planes, blending with white like \ref colorDelta.
+YiqPlanes toYiqPlanes(span<const uint8_t> img, int width, int height, size_t strideInPixels) {
+  YiqPlanes planes;
+  planes.width = width;
+  planes.height = height;
+
+  const size_t size = static_cast<size_t>(width) * height;
+  planes.y.resize(size);
+  planes.i.resize(size);
+  planes.q.resize(size);
+
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const size_t pos = (y * strideInPixels + x) * kPixelChannels;
+      uint8_t r = img[pos + 0];
+      uint8_t g = img[pos + 1];
+      uint8_t b = img[pos + 2];
+      const uint8_t a = img[pos + 3];
+
+      if (a < 255) {
+        const float alpha = a / 255.0f;
+        r = blend(r, alpha);
+        g = blend(g, alpha);
+        b = blend(b, alpha);
+      }
+
+      const size_t index = static_cast<size_t>(y) * width + x;
+      planes.y[index] = rgb2y(r, g, b);
+      planes.i[index] = rgb2i(r, g, b);
+      planes.q[index] = rgb2q(r, g, b);
+    }
+  }
+
+  return planes;
+}
+
+/// Halve the resolution of the planes with a 2x2 box filter, dropping an odd last row or column.
+YiqPlanes downsample(const YiqPlanes& planes) {
+  YiqPlanes result;
+  result.width = planes.width / 2;
+  result.height = planes.height / 2;
+
+  const auto downsamplePlane = [&](const std::vector<float>& src, std::vector<float>& dst) {
+    dst.resize(static_cast<size_t>(result.width) * result.height);
+    for (int y = 0; y < result.height; ++y) {
+      const float* row0 = &src[static_cast<size_t>(2 * y) * planes.width];
+      const float* row1 = row0 + planes.width;
+      for (int x = 0; x < result.width; ++x) {
+        dst[static_cast<size_t>(y) * result.width + x] =
+            0.25f * (row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1]);
+      }
+    }
+  };
+
+  downsamplePlane(planes.y, result.y);
+  downsamplePlane(planes.i, result.i);
+  downsamplePlane(planes.q, result.q);
+  return result;
+}
+
+/**
+ * Sum the YIQ deltas between \ref sub and the window of \ref img at (offsetX, offsetY), which
+ * equals the sum of \ref colorDelta magnitudes on full resolution planes.
+ *
+ * Rejects early: once the partial sum reaches \ref limit, it is returned without summing the
+ * remaining rows.
+ */
+float windowDelta(const YiqPlanes& img, const YiqPlanes& sub, int offsetX, int offsetY,
+                  float limit) noexcept {
+  constexpr int kLanes = 8;
+
+  float total = 0.0f;
+  for (int y = 0; y < sub.height; ++y) {
+    const size_t imgRow = static_cast<size_t>(offsetY + y) * img.width + offsetX;
+    const size_t subRow = static_cast<size_t>(y) * sub.width;
+    const float* imgY = &img.y[imgRow];
+    const float* imgI = &img.i[imgRow];
+    const float* imgQ = &img.q[imgRow];
+    const float* subY = &sub.y[subRow];
+    const float* subI = &sub.i[subRow];
+    const float* subQ = &sub.q[subRow];
+
+    // Accumulate into independent lanes, so that the compiler can vectorize the loop without
+    // having to reassociate the floating point additions.
+    float lanes[kLanes] = {};
+    int x = 0;
+    for (; x + kLanes <= sub.width; x += kLanes) {
+      for (int lane = 0; lane < kLanes; ++lane) {
+        const float dy = imgY[x + lane] - subY[x + lane];
+        const float di = imgI[x + lane] - subI[x + lane];
+        const float dq = imgQ[x + lane] - subQ[x + lane];
+        lanes[lane] += 0.5053f * dy * dy + 0.299f * di * di + 0.1957f * dq * dq;
+      }
+    }
+
+    for (; x < sub.width; ++x) {
+      const float dy = imgY[x] - subY[x];
+      const float di = imgI[x] - subI[x];
+      const float dq = imgQ[x] - subQ[x];
+      lanes[0] += 0.5053f * dy * dy + 0.299f * di * di + 0.1957f * dq * dq;
+    }
+
+    for (const float lane : lanes) {
+      total += lane;
+    }
+
+    if (total >= limit) {
+      break;
+    }
+  }
+
+  return total;
+}
+
+/// A candidate position of the sub-image during the search, and its window delta.
+struct SearchCandidate {
+  int x = 0;
+  int y = 0;
+  float cost = 0.0f;
+};
+
+/**
+ * Find the offset of \ref sub inside \ref img minimizing \ref windowDelta, searching
+ * exhaustively on a downsampled pyramid and then refining the best candidates level by level.
+ */
+SearchCandidate searchSubImage(YiqPlanes img, YiqPlanes sub) {
+  // Stop downsampling before the sub-image loses too much detail to be located reliably.
+  constexpr int kMinCoarseSize = 8;
+  constexpr int kMaxLevels = 5;
+  // Number of candidates tracked from the coarsest level, to recover from aliasing.
+  constexpr size_t kCandidates = 8;
+  constexpr float kNoLimit = std::numeric_limits<float>::infinity();
+
+  std::vector<YiqPlanes> imgLevels;
+  std::vector<YiqPlanes> subLevels;
+  imgLevels.push_back(std::move(img));
+  subLevels.push_back(std::move(sub));
+  while (static_cast<int>(subLevels.size()) < kMaxLevels &&
+         subLevels.back().width >= 2 * kMinCoarseSize &&
+         subLevels.back().height >= 2 * kMinCoarseSize) {
+    imgLevels.push_back(downsample(imgLevels.back()));
+    subLevels.push_back(downsample(subLevels.back()));
+  }
+
+  // Exhaustive search at the coarsest level, keeping the best candidates sorted by cost. A window
+  // is abandoned as soon as it cannot beat the worst candidate kept so far.
+  std::vector<SearchCandidate> candidates;
+  {
+    const YiqPlanes& coarseImg = imgLevels.back();
+    const YiqPlanes& coarseSub = subLevels.back();
+    for (int y = 0; y <= coarseImg.height - coarseSub.height; ++y) {
+      for (int x = 0; x <= coarseImg.width - coarseSub.width; ++x) {
+        const float limit = candidates.size() < kCandidates ? kNoLimit : candidates.back().cost;
+        const float cost = windowDelta(coarseImg, coarseSub, x, y, limit);
+        if (cost >= limit) {
+          continue;
+        }
+
+        const SearchCandidate candidate{x, y, cost};
+        candidates.insert(std::upper_bound(candidates.begin(), candidates.end(), candidate,
+                                           [](const SearchCandidate& a, const SearchCandidate& b) {
+                                             return a.cost < b.cost;
+                                           }),
+                          candidate);
+        if (candidates.size() > kCandidates) {
+          candidates.pop_back();
+        }
+      }
+    }
+  }
+
+  // Refine each candidate in a small neighborhood at each finer level.
+  for (int level = static_cast<int>(imgLevels.size()) - 2; level >= 0; --level) {
+    const YiqPlanes& levelImg = imgLevels[level];
+    const YiqPlanes& levelSub = subLevels[level];
+    const int maxX = levelImg.width - levelSub.width;
+    const int maxY = levelImg.height - levelSub.height;
+
+    for (SearchCandidate& candidate : candidates) {
+      SearchCandidate best{0, 0, kNoLimit};
+      for (int y = std::max(0, 2 * candidate.y - 2); y <= std::min(maxY, 2 * candidate.y + 2);
+           ++y) {
+        for (int x = std::max(0, 2 * candidate.x - 2); x <= std::min(maxX, 2 * candidate.x + 2);
+             ++x) {
+          const float cost = windowDelta(levelImg, levelSub, x, y, best.cost);
+          if (cost < best.cost) {
+            best = SearchCandidate{x, y, cost};
+          }
+        }
+      }
+
+      candidate = best;
+    }
+  }
+
+  return *std::min_element(candidates.begin(), candidates.end(),
+                           [](const SearchCandidate& a, const SearchCandidate& b) {
+                             return a.cost < b.cost || (a.cost == b.cost &&
+                                                        (a.y < b.y || (a.y == b.y && a.x < b.x)));
+                           });
+}
+
+/// A detected shift is kept only if the diff after shifting is below this fraction of the diff
+/// without shifting.
+constexpr double kMinShiftImprovement = 0.9;
+
+/// Magic bytes and version of the format written by \ref encodeSparseDiff.
+constexpr uint8_t kSparseDiffMagic[4] = {'P', 'M', 'S', 'D'};
+constexpr uint8_t kSparseDiffVersion = 1;
+constexpr uint32_t kDiffRunKinds = 3;
+
+/**
+ * Check that the runs of a sparse diff are within its bounds, sorted by row then column, and do
+ * not overlap.
+ */
+bool validateRuns(const SparseDiff& diff) noexcept {
+  if (diff.width <= 0 || diff.height <= 0) {
+    return false;
+  }
+
+  int32_t y = 0;
+  int32_t minX = 0;
+  for (const DiffRun& run : diff.runs) {
+    if (run.y < y || run.y >= diff.height || static_cast<uint32_t>(run.kind) >= kDiffRunKinds) {
+      return false;
+    }
+
+    if (run.y > y) {
+      y = run.y;
+      minX = 0;
+    }
+
+    if (run.x < minX || run.length <= 0 || run.length > diff.width - run.x) {
+      return false;
+    }
+
+    minX = run.x + run.length;
+  }
+
+  return true;
+}
+
+/// Append an unsigned LEB128 varint. May throw.
+void writeVarint(std::vector<uint8_t>& out, uint32_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+/// Read an unsigned LEB128 varint of up to 32 bits, advancing \ref pos. Returns false on error.
+bool readVarint(span<const uint8_t> in, size_t& pos, uint32_t& value) noexcept {
+  value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (pos >= in.size()) {
+      return false;
+    }
+
+    const uint8_t byte = in[pos++];
+    if (shift == 28 && (byte & 0x70) != 0) {
+      return false;  // Does not fit in 32 bits.
+    }
+
+    value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+}  // namespace
+
+int pixelmatch(span<const uint8_t> img1, span<const uint8_t> img2, span<uint8_t> output, int width,
+               int height, size_t strideInPixels, Options options) noexcept {
+  return pixelmatchImpl<uint8_t>(img1, img2, output, width, height, strideInPixels, options);
+}
+
+int pixelmatch(span<const uint16_t> img1, span<const uint16_t> img2, span<uint16_t> output,
+               int width, int height, size_t strideInPixels, Options options) noexcept {
+  return pixelmatchImpl<uint16_t>(img1, img2, output, width, height, strideInPixels, options);
+}
+
+int pixelmatch(span<const float> img1, span<const float> img2, span<float> output, int width,
+               int height, size_t strideInPixels, Options options) noexcept {
+  return pixelmatchImpl<float>(img1, img2, output, width, height, strideInPixels, options);
+}
+
+int pixelmatchWithDeltas(span<const uint8_t> img1, span<const uint8_t> img2,
+                         span<uint8_t> output, span<float> deltas, int width, int height,
+                         size_t strideInPixels, Options options) noexcept {
+  if (deltas.empty()) {
+    assert(!deltas.empty() && "Delta plane must not be empty");
+    return -1;
+  }
+
+  return pixelmatchImpl<uint8_t, float>(img1, img2, output, width, height, strideInPixels,
+                                        options, deltas);
+}
+
+int pixelmatchWithDeltas(span<const uint8_t> img1, span<const uint8_t> img2,
+                         span<uint8_t> output, span<uint16_t> deltas, int width, int height,
+                         size_t strideInPixels, Options options) noexcept {
+  if (deltas.empty()) {
+    assert(!deltas.empty() && "Delta plane must not be empty");
+    return -1;
+  }
+
+  return pixelmatchImpl<uint8_t, uint16_t>(img1, img2, output, width, height, strideInPixels,
+                                           options, deltas);
+}
+
+std::optional<std::vector<int>> pixelmatchThresholds(span<const uint8_t> img1,
+                                                     span<const uint8_t> img2, int width,
+                                                     int height, size_t strideInPixels,
+                                                     span<const float> thresholds,
+                                                     Options options) noexcept {
+  if (!validateInputs(img1, img2, width, height, strideInPixels)) {
+    return std::nullopt;
+  }
+
+  // Pixels are bucketed by the squared thresholds, which are only sorted like the thresholds if
+  // none is negative.
+  const float* thresholdsEnd = thresholds.data() + thresholds.size();
+  const bool nonNegative =
+      std::all_of(thresholds.data(), thresholdsEnd, [](float t) { return t >= 0.0f; });
+  if (thresholds.empty() || !nonNegative || !std::is_sorted(thresholds.data(), thresholdsEnd)) {
+    assert(!thresholds.empty() && "At least one threshold is required");
+    assert(nonNegative && "Thresholds must not be negative");
+    assert(std::is_sorted(thresholds.data(), thresholdsEnd) &&
+           "Thresholds must be sorted in ascending order");
+    return std::nullopt;
+  }
+
+  const size_t thresholdCount = thresholds.size();
+  constexpr int kBandRows = 64;
+  const size_t bandCount =
+      options.executor != nullptr ? static_cast<size_t>((height - 1) / kBandRows + 1) : 1;
+  const int bandRows = options.executor != nullptr ? kBandRows : height;
+
+  std::vector<int> diffs;
+  std::vector<float> maxDeltas;
+  std::vector<int> exceededCounts;
+  try {
+    diffs.resize(thresholdCount, 0);
+    if (imagesIdentical(img1, img2, width, height, strideInPixels)) {
+      return diffs;
+    }
+
+    maxDeltas.resize(thresholdCount);
+    // Each band counts into its own row of buckets.
+    exceededCounts.resize(bandCount * (thresholdCount + 1), 0);
+  } catch (...) {
+    return std::nullopt;
+  }
+
+  for (size_t i = 0; i < thresholdCount; ++i) {
+    maxDeltas[i] = maxDeltaForThreshold<uint8_t>(thresholds[i]);
+  }
+
+  // Count each different pixel once, in the bucket of the number of thresholds it exceeds. The
+  // anti-aliasing check does not depend on the threshold, so it runs at most once per pixel.
+  const auto countBand = [&](size_t band) noexcept {
+    int* counts = &exceededCounts[band * (thresholdCount + 1)];
+    const int startY = static_cast<int>(band) * bandRows;
+    const int endY = std::min(startY + bandRows, height);
+
+    withColorMetric(options.colorMetric, [&](auto metric) noexcept {
+      constexpr ColorMetric kMetric = decltype(metric)::value;
+      MetricCache<uint8_t> cache;
+      for (int y = startY; y < endY; ++y) {
+        for (int x = 0; x < width; ++x) {
+          const size_t pos = (y * strideInPixels + x) * kPixelChannels;
+          const float delta = std::abs(metricDelta<kMetric>(img1, img2, pos, cache));
+
+          // The number of thresholds for which the pixel is above the maximum delta.
+          const size_t exceeded = static_cast<size_t>(
+              std::lower_bound(maxDeltas.begin(), maxDeltas.end(), delta) - maxDeltas.begin());
+          if (exceeded == 0) {
+            continue;
+          }
+
+          if (!options.includeAA &&
+              (antialiased(img1, x, y, width, height, strideInPixels, img2) ||
+               antialiased(img2, x, y, width, height, strideInPixels, img1))) {
+            continue;
+          }
+
+          ++counts[exceeded];
+        }
+      }
+    });
+  };
+
+  if (options.executor != nullptr) {
+    options.executor->parallelFor(0, bandCount, countBand);
+  } else {
+    countBand(0);
+  }
+
+  // A pixel which exceeds the first n thresholds is a difference for each of them.
+  int total = 0;
+  for (size_t i = thresholdCount; i > 0; --i) {
+    for (size_t band = 0; band < bandCount; ++band) {
+      total += exceededCounts[band * (thresholdCount + 1) + i];
+    }
+
+    diffs[i - 1] = total;
+  }
+
+  return diffs;
+}
+
+int pixelmatchSparse(span<const uint8_t> img1, span<const uint8_t> img2, int width, int height,
+                     size_t strideInPixels, SparseDiff& diff, Options options) noexcept {
+  diff.width = width;
+  diff.height = height;
+  return pixelmatchImpl<uint8_t>(img1, img2, span<uint8_t>(), width, height, strideInPixels,
+                                 options, span<float>(), &diff.runs);
+}
+
+bool renderSparseDiff(const SparseDiff& diff, span<const uint8_t> img1, size_t strideInPixels,
+                      span<uint8_t> output, Options options) noexcept {
+  if (!validateImage(img1, diff.width, diff.height, strideInPixels)) {
+    return false;
+  }
+
+  if (output.size() != img1.size()) {
+    assert(output.size() == img1.size() && "Output size does not match img1");
+    return false;
+  }
+
+  if (!validateRuns(diff)) {
+    assert(false && "Sparse diff runs are out of order or bounds");
+    return false;
+  }
+
+  // Draw each row as the grayscale background up to the next run, then the run.
+  auto run = diff.runs.begin();
+  for (int y = 0; y < diff.height; ++y) {
+    const size_t rowPos = y * strideInPixels * kPixelChannels;
+    int x = 0;
+    const auto drawBackground = [&](int endX) noexcept {
+      for (; x < endX; ++x) {
+        if (!options.diffMask) {
+          drawGrayPixel(img1, rowPos + x * kPixelChannels, options.alpha, output);
+        }
+      }
+    };
+
+    for (; run != diff.runs.end() && run->y == y; ++run) {
+      drawBackground(run->x);
+
+      if (run->kind == DiffRunKind::kAntialiased && options.diffMask) {
+        x += run->length;
+        continue;
+      }
+
+      const Color color = run->kind == DiffRunKind::kAntialiased ? options.aaColor
+                          : run->kind == DiffRunKind::kDiffAlt && options.diffColorAlt
+                              ? options.diffColorAlt.value()
+                              : options.diffColor;
+      for (const int endX = x + run->length; x < endX; ++x) {
+        drawPixel(output, rowPos + x * kPixelChannels, color);
+      }
+    }
+
+    drawBackground(diff.width);
+  }
+
+  return true;
+}
+
+bool encodeSparseDiff(const SparseDiff& diff, std::vector<uint8_t>& encoded) noexcept {
+  if (!validateRuns(diff)) {
+    assert(false && "Sparse diff runs are out of order or bounds");
+    return false;
+  }
+
+  try {
+    encoded.assign(std::begin(kSparseDiffMagic), std::end(kSparseDiffMagic));
+    encoded.push_back(kSparseDiffVersion);
+    writeVarint(encoded, static_cast<uint32_t>(diff.width));
+    writeVarint(encoded, static_cast<uint32_t>(diff.height));
+    writeVarint(encoded, static_cast<uint32_t>(diff.runs.size()));
+
+    int32_t y = 0;
+    int32_t endX = 0;
+    for (const DiffRun& run : diff.runs) {
+      const bool sameRow = run.y == y;
+      writeVarint(encoded, static_cast<uint32_t>(run.y - y));
+      writeVarint(encoded, static_cast<uint32_t>(sameRow ? run.x - endX : run.x));
+      writeVarint(encoded, static_cast<uint32_t>(run.length - 1) * kDiffRunKinds +
+                               static_cast<uint32_t>(run.kind));
+
+      y = run.y;
+      endX = run.x + run.length;
+    }
+  } catch (...) {
+    encoded.clear();
+    return false;
+  }
+
+  return true;
+}
+
+std::optional<SparseDiff> decodeSparseDiff(span<const uint8_t> encoded) noexcept {
+  constexpr size_t kHeaderSize = sizeof(kSparseDiffMagic) + 1;
+  if (encoded.size() < kHeaderSize ||
+      !std::equal(std::begin(kSparseDiffMagic), std::end(kSparseDiffMagic), &encoded[0]) ||
+      encoded[sizeof(kSparseDiffMagic)] != kSparseDiffVersion) {
+    return std::nullopt;
+  }
+
+  size_t pos = kHeaderSize;
+  uint32_t width;
+  uint32_t height;
+  uint32_t runCount;
+  if (!readVarint(encoded, pos, width) || !readVarint(encoded, pos, height) ||
+      !readVarint(encoded, pos, runCount) ||
+      width > static_cast<uint32_t>(std::numeric_limits<int32_t>::max()) ||
+      height > static_cast<uint32_t>(std::numeric_limits<int32_t>::max())) {
+    return std::nullopt;
+  }
+
+  // Each run takes at least 3 bytes, check before allocating so that a corrupt count cannot
+  // request a huge allocation.
+  if (runCount > (encoded.size() - pos) / 3) {
+    return std::nullopt;
+  }
+
+  SparseDiff diff;
+  diff.width = static_cast<int32_t>(width);
+  diff.height = static_cast<int32_t>(height);
+  try {
+    diff.runs.resize(runCount);
+  } catch (...) {
+    return std::nullopt;
+  }
+
+  int64_t y = 0;
+  int64_t endX = 0;
+  for (DiffRun& run : diff.runs) {
+    uint32_t deltaY;
+    uint32_t x;
+    uint32_t lengthAndKind;
+    if (!readVarint(encoded, pos, deltaY) || !readVarint(encoded, pos, x) ||
+        !readVarint(encoded, pos, lengthAndKind)) {
+      return std::nullopt;
+    }
+
+    const int64_t runY = y + deltaY;
+    const int64_t runX = deltaY == 0 ? endX + x : x;
+    const int64_t length = static_cast<int64_t>(lengthAndKind / kDiffRunKinds) + 1;
+    if (runY >= diff.height || runX + length > diff.width) {
+      return std::nullopt;
+    }
+
+    run.x = static_cast<int32_t>(runX);
+    run.y = static_cast<int32_t>(runY);
+    run.length = static_cast<int32_t>(length);
+    run.kind = static_cast<DiffRunKind>(lengthAndKind % kDiffRunKinds);
+
+    y = runY;
+    endX = runX + length;
+  }
+
+  if (pos != encoded.size() || !validateRuns(diff)) {
+    return std::nullopt;
+  }
+
+  return diff;
+}
+
+std::optional<Translation> estimateTranslation(span<const uint8_t> img1,
+                                               span<const uint8_t> img2, int width, int height,
+                                               size_t strideInPixels, int maxShift) noexcept {
+  if (!validateInputs(img1, img2, width, height, strideInPixels) || maxShift < 0) {
+    assert(maxShift >= 0);
+    return std::nullopt;
+  }
+
+  // Estimate the vertical and horizontal shift independently from the row and column brightness
+  // projections, which reduces the 2D search to two 1D searches.
+  std::vector<float> rows1, columns1, rows2, columns2;
+  try {
+    brightnessProfiles(img1, width, height, strideInPixels, rows1, columns1);
+    brightnessProfiles(img2, width, height, strideInPixels, rows2, columns2);
+  } catch (...) {
+    return std::nullopt;
+  }
+
+  Translation result;
+  result.dx = bestProfileShift(columns1, columns2, maxShift);
+  result.dy = bestProfileShift(rows1, rows2, maxShift);
+  return result;
+}
+
+std::optional<AlignedResult> pixelmatchAligned(span<const uint8_t> img1,
+                                               span<const uint8_t> img2, span<uint8_t> output,
+                                               int width, int height, size_t strideInPixels,
+                                               int maxShift, Options options) noexcept {
+  if (output.size() != img1.size() && !output.empty()) {
+    assert(img1.size() == output.size() || output.empty());
+    return std::nullopt;
+  }
+
+  const std::optional<Translation> translation =
+      estimateTranslation(img1, img2, width, height, strideInPixels, maxShift);
+  if (!translation) {
+    return std::nullopt;
+  }
+
+  AlignedResult result;
+  if (translation->dx == 0 && translation->dy == 0) {
+    result.diff = pixelmatch(img1, img2, output, width, height, strideInPixels, options);
+    return result;
+  }
+
+  // With a diff mask, pixels that match are left as they are, so the output of a rejected shift
+  // cannot simply be drawn over. Keep a copy of the output to restore in that case.
+  std::vector<uint8_t> savedOutput;
+  if (options.diffMask && !output.empty()) {
+    try {
+      savedOutput.assign(output.data(), output.data() + output.size());
+    } catch (...) {
+      return std::nullopt;
+    }
+  }
+
+  result.translation = translation.value();
+  result.diff = compareShifted(img1, img2, output, width, height, strideInPixels,
+                               result.translation, options);
+  if (result.diff < 0) {
+    return std::nullopt;
+  }
+
+  // The shift is only estimated from brightness profiles, which can be fooled on mostly uniform
+  // images, where a spurious shift turns whole border strips into differences. Keep it only if it
+  // clearly reduces the exact unshifted diff.
+  const int unshiftedDiff =
+      pixelmatch(img1, img2, span<uint8_t>(), width, height, strideInPixels, options);
+  if (unshiftedDiff < 0) {
+    return std::nullopt;
+  }
+
+  if (result.diff < kMinShiftImprovement * unshiftedDiff) {
+    return result;
+  }
+
+  result.translation = Translation();
+  result.diff = unshiftedDiff;
+  if (!output.empty()) {
+    if (!savedOutput.empty()) {
+      std::memcpy(&output[0], savedOutput.data(), savedOutput.size());
+    }
+
+    result.diff = pixelmatch(img1, img2, output, width, height, strideInPixels, options);
+  }
+
+  return result;
+}
+
+std::optional<SubImageMatch> findSubImage(span<const uint8_t> img, int width, int height,
+                                          size_t strideInPixels, span<const uint8_t> subImg,
+                                          int subWidth, int subHeight, size_t subStrideInPixels,
+                                          span<uint8_t> output, Options options) noexcept {
+  if (!validateImage(img, width, height, strideInPixels) ||
+      !validateImage(subImg, subWidth, subHeight, subStrideInPixels)) {
+    return std::nullopt;
+  }
+
+  if (subWidth > width || subHeight > height) {
+    assert(subWidth <= width && "Sub-image must fit inside the image");
+    assert(subHeight <= height && "Sub-image must fit inside the image");
+    return std::nullopt;
+  }
+
+  if (output.size() != subImg.size() && !output.empty()) {
+    assert(subImg.size() == output.size() || output.empty());
+    return std::nullopt;
+  }
+
+  // The search allocates YIQ planes for both images and their pyramids.
+  SearchCandidate best;
+  std::vector<uint8_t> window;
+  try {
+    best = searchSubImage(toYiqPlanes(img, width, height, strideInPixels),
+                          toYiqPlanes(subImg, subWidth, subHeight, subStrideInPixels));
+    window.resize(subImg.size());
+  } catch (...) {
+    return std::nullopt;
+  }
+
+  // Copy the matched window with the layout of the sub-image, so that the diff count is exactly
+  // what pixelmatch returns for a crop of the image at this offset.
+  for (int y = 0; y < subHeight; ++y) {
+    std::memcpy(&window[y * subStrideInPixels * kPixelChannels],
+                &img[((best.y + y) * strideInPixels + best.x) * kPixelChannels],
+                subWidth * kPixelChannels);
+  }
+
+  SubImageMatch result;
+  result.x = best.x;
+  result.y = best.y;
+  result.diff = pixelmatch(window, subImg, output, subWidth, subHeight, subStrideInPixels, options);
+  return result;
+}
+
+std::optional<DiffEstimate> estimatePixelmatch(span<const uint8_t> img1,
+                                               span<const uint8_t> img2, int width, int height,
+                                               size_t strideInPixels, Options options,
+                                               SampleOptions sampleOptions) noexcept {
+  if (!validateInputs<uint8_t>(img1, img2, width, height, strideInPixels)) {
+    return std::nullopt;
+  }
+
+  if (sampleOptions.cellSize <= 0 || !(sampleOptions.confidenceZ >= 0.0f)) {
+    assert(sampleOptions.cellSize > 0);
+    assert(sampleOptions.confidenceZ >= 0.0f);
+    return std::nullopt;
+  }
+
+  const float kMaxDelta = maxDeltaForThreshold<uint8_t>(options.threshold);
+  const int cellSize = sampleOptions.cellSize;
+
+  // Stratified sampling: evaluate one pixel per cell, at a deterministic jittered position. Each
+  // sample is weighted by its cell area so that clipped cells at the edges are not over-counted.
+  DiffEstimate estimate;
+  double weightedDiff = 0.0;
+  withColorMetric(options.colorMetric, [&](auto metric) noexcept {
+    constexpr ColorMetric kMetric = decltype(metric)::value;
+    MetricCache<uint8_t> cache;
+    for (int cellY = 0; cellY < height; cellY += cellSize) {
+      const int cellHeight = std::min(cellSize, height - cellY);
+
+      for (int cellX = 0; cellX < width; cellX += cellSize) {
+        const int cellWidth = std::min(cellSize, width - cellX);
+        const uint32_t hash =
+            hashCell(static_cast<uint32_t>(cellX), static_cast<uint32_t>(cellY));
+        const int x =
+            cellX + static_cast<int>((hash & 0xFFFFu) % static_cast<uint32_t>(cellWidth));
+        const int y = cellY + static_cast<int>((hash >> 16) % static_cast<uint32_t>(cellHeight));
+
+        float delta;
+        const PixelKind kind =
+            classifyPixel<kMetric, uint8_t>(img1, img2, x, y, width, height, strideInPixels,
+                                            kMaxDelta, options.includeAA, cache, delta);
+
+        ++estimate.sampledPixels;
+        if (kind == PixelKind::kDifferent) {
+          ++estimate.sampledDiff;
+          weightedDiff += static_cast<double>(cellWidth) * cellHeight;
+        }
+      }
+    }
+  });
+
+  // Wilson score interval on the fraction of different pixels, scaled to the full image.
+  const double totalPixels = static_cast<double>(width) * height;
+  const double n = estimate.sampledPixels;
+  const double p = weightedDiff / totalPixels;
+  const double z = sampleOptions.confidenceZ;
+  const double z2 = z * z;
+  const double center = (p + z2 / (2.0 * n)) / (1.0 + z2 / n);
+  const double halfWidth = z / (1.0 + z2 / n) * std::sqrt(p * (1.0 - p) / n + z2 / (4.0 * n * n));
+
+  estimate.estimatedDiff = weightedDiff;
+  estimate.lowerBound = std::max(0.0, center - halfWidth) * totalPixels;
+  estimate.upperBound = std::min(1.0, center + halfWidth) * totalPixels;
+  return estimate;
+}
+
+std::optional<QuickCheckResult> pixelmatchQuickCheck(span<const uint8_t> img1,
+                                                     span<const uint8_t> img2, int width,
+                                                     int height, size_t strideInPixels,
+                                                     int allowedDiff, Options options,
+                                                     SampleOptions sampleOptions) noexcept {
+  QuickCheckResult result;
+
+  // With no allowed difference, the confidence interval of a sample without differences always
+  // contains allowedDiff, so the estimate can only answer when it finds a difference. Identical
+  // images are the common case for this, so check for them exactly before sampling.
+  if (allowedDiff <= 0) {
+    if (!validateInputs(img1, img2, width, height, strideInPixels)) {
+      return std::nullopt;
+    }
+
+    if (imagesIdentical(img1, img2, width, height, strideInPixels)) {
+      result.exact = true;
+      result.exceedsAllowedDiff = allowedDiff < 0;
+      return result;
+    }
+  }
+
+  const std::optional<DiffEstimate> estimate = estimatePixelmatch(
+      img1, img2, width, height, strideInPixels, options, sampleOptions);
+  if (!estimate) {
+    return std::nullopt;
+  }
+
+  result.estimate = estimate.value();
+
+  if (estimate->sampledDiff > allowedDiff) {
+    // Sampled pixels are classified exactly, so they alone are over the allowed difference.
+    result.exceedsAllowedDiff = true;
+    result.diff = std::max(static_cast<int>(std::lround(estimate->estimatedDiff)),
+                           estimate->sampledDiff);
+  } else if (estimate->upperBound <= allowedDiff) {
+    // Clearly within the allowed difference.
+    result.exceedsAllowedDiff = false;
+    result.diff = static_cast<int>(std::lround(estimate->estimatedDiff));
+  } else if (estimate->lowerBound > allowedDiff) {
+    // Clearly over the allowed difference.
+    result.exceedsAllowedDiff = true;
+    result.diff = static_cast<int>(std::lround(estimate->estimatedDiff));
+  } else {
+    // Too close to call, escalate to the full comparison.
+    result.exact = true;
+    result.diff =
+        pixelmatch(img1, img2, span<uint8_t>(), width, height, strideInPixels, options);
+    result.exceedsAllowedDiff = result.diff > allowedDiff;
+  }
+
+  return result;
+}
+
 }  // namespace pixelmatch
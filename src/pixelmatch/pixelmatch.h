@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <optional>
+#include <vector>
 
 #if __cplusplus > 201703L
 #include <span>
@@ -48,6 +49,8 @@ private:
 };
 #endif
 
+class Executor;
+
 /**
  * RGBA-ordered 32-bit color.
  */
@@ -58,6 +61,19 @@ struct Color {
   uint8_t a;
 };
 
+/**
+ * Color difference metric used to compare pixels.
+ *
+ * The threshold keeps the 0 to 1 range with every metric, and anti-aliasing detection always uses
+ * the YIQ brightness difference. OKLab costs slightly more than YIQ, CIEDE2000 about three times
+ * as much on images where most pixels differ.
+ */
+enum class ColorMetric {
+  kYiq,        //!< YIQ NTSC transmission color space difference, as in the original pixelmatch.
+  kOklab,      //!< Euclidean distance in OKLab. The threshold is the OKLab distance (0 to 1).
+  kCiede2000,  //!< CIEDE2000 color difference in CIELAB. The threshold is ΔE00 / 100.
+};
+
 /**
  * Pixelmatch options.
  *
@@ -74,6 +90,17 @@ struct Options {
       std::nullopt;  //!< Whether to detect dark on light differences between img1 and img2 and set
                      //!< an alternative color to differentiate between the two
   bool diffMask = false;  //!< Draw the diff over a transparent background (a mask)
+  int tileSize = 0;  //!< If > 0, compare pixels in square tiles of this size, copying each tile
+                     //!< that differs and its halo to a small buffer from which anti-aliasing
+                     //!< detection reads neighborhoods, which keeps them in cache on wide images.
+                     //!< Does not change the result. 0 compares row by row.
+  bool heatmap = false;  //!< Draw different pixels with a color ramp by how far they are over the
+                         //!< threshold, instead of diffColor and diffColorAlt
+  span<const Color> heatmapColors;  //!< Color ramp of the heatmap, from just over the threshold to
+                                    //!< the maximum difference. If empty, uses a blue to red ramp.
+  Executor* executor = nullptr;  //!< If set, compare bands of rows in parallel on this executor.
+                                 //!< See pixelmatch/executor.h.
+  ColorMetric colorMetric = ColorMetric::kYiq;  //!< Metric used to compare the color of pixels.
 };
 
 /**
@@ -94,4 +121,336 @@ struct Options {
 int pixelmatch(span<const uint8_t> img1, span<const uint8_t> img2, span<uint8_t> output, int width,
                int height, size_t strideInPixels, Options options = Options()) noexcept;
 
+/**
+ * Compares two images with 16 bits per channel, see \ref pixelmatch for details.
+ *
+ * Channel values range from 0 to 65535, and the threshold is scaled accordingly so that options
+ * behave the same as for 8-bit images. Colors in \ref Options are expanded to 16 bits.
+ */
+int pixelmatch(span<const uint16_t> img1, span<const uint16_t> img2, span<uint16_t> output,
+               int width, int height, size_t strideInPixels, Options options = Options()) noexcept;
+
+/**
+ * Compares two images with floating point channels, see \ref pixelmatch for details.
+ *
+ * Channel values nominally range from 0 to 1, and the threshold is scaled accordingly so that
+ * options behave the same as for 8-bit images. Values above 1, such as from HDR images, are
+ * compared without clamping. Colors in \ref Options are converted to the 0 to 1 range.
+ */
+int pixelmatch(span<const float> img1, span<const float> img2, span<float> output, int width,
+               int height, size_t strideInPixels, Options options = Options()) noexcept;
+
+/**
+ * Compares two images like \ref pixelmatch, and additionally writes the color difference of every
+ * pixel to a delta plane, so that it can be re-thresholded without comparing the images again.
+ *
+ * Each delta is the smallest threshold at which the pixel is considered similar, between 0 and 1:
+ * a pixel is different before anti-aliasing detection if its delta is greater than
+ * Options::threshold.
+ *
+ * @param img1 First image, see \ref pixelmatch.
+ * @param img2 Second image, must be the same size as img1.
+ * @param output (Optional) Output image buffer, of the same size as img1, or an empty span.
+ * @param deltas Output delta plane, with one element per pixel: must be strideInPixels * height
+ *               elements long.
+ * @param width in pixels, must be > 0.
+ * @param height in pixels, must be > 0.
+ * @param strideInPixels Stride of the image, in pixels, must be >= width.
+ * @param options Configuration options for the pixel comparison algorithm.
+ * @return The number of different pixels, or -1 if a precondition fails.
+ */
+int pixelmatchWithDeltas(span<const uint8_t> img1, span<const uint8_t> img2,
+                         span<uint8_t> output, span<float> deltas, int width, int height,
+                         size_t strideInPixels, Options options = Options()) noexcept;
+
+/**
+ * Compares two images like \ref pixelmatch, and writes the delta plane quantized to 16 bits, with
+ * 65535 as the maximum difference. See the float overload for details.
+ */
+int pixelmatchWithDeltas(span<const uint8_t> img1, span<const uint8_t> img2,
+                         span<uint8_t> output, span<uint16_t> deltas, int width, int height,
+                         size_t strideInPixels, Options options = Options()) noexcept;
+
+/**
+ * Compares two images once for several thresholds, returning the same diff counts as calling
+ * \ref pixelmatch with each threshold, in a single pass over the images.
+ *
+ * The color difference and anti-aliasing detection of each pixel are computed once and shared by
+ * all thresholds, which is much cheaper than comparing again for each threshold.
+ *
+ * @param img1 First image, see \ref pixelmatch.
+ * @param img2 Second image, must be the same size as img1.
+ * @param width in pixels, must be > 0.
+ * @param height in pixels, must be > 0.
+ * @param strideInPixels Stride of the image, in pixels, must be >= width.
+ * @param thresholds Matching thresholds, must not be empty or negative, and sorted in ascending
+ *                   order.
+ * @param options Configuration options for the pixel comparison algorithm. Options::threshold and
+ *                the output options are ignored. With Options::executor, bands of rows are
+ *                counted in parallel.
+ * @return The number of different pixels for each threshold, in the same order, or std::nullopt
+ *         if a precondition fails or memory cannot be allocated.
+ */
+std::optional<std::vector<int>> pixelmatchThresholds(span<const uint8_t> img1,
+                                                     span<const uint8_t> img2, int width,
+                                                     int height, size_t strideInPixels,
+                                                     span<const float> thresholds,
+                                                     Options options = Options()) noexcept;
+
+/**
+ * Kind of the pixels of a \ref DiffRun, which determines how they are drawn.
+ */
+enum class DiffRunKind : uint8_t {
+  kDiff,         //!< Different pixels, drawn with Options::diffColor.
+  kDiffAlt,      //!< Different pixels that are darker in img2, drawn with Options::diffColorAlt if
+                 //!< set, and Options::diffColor otherwise.
+  kAntialiased,  //!< Anti-aliased pixels, drawn with Options::aaColor.
+};
+
+/**
+ * Horizontal run of consecutive pixels of the same kind in a \ref SparseDiff.
+ */
+struct DiffRun {
+  int32_t x = 0;       //!< Column of the first pixel.
+  int32_t y = 0;       //!< Row of the pixels.
+  int32_t length = 0;  //!< Number of pixels, at least 1.
+  DiffRunKind kind = DiffRunKind::kDiff;  //!< Kind of the pixels.
+};
+
+/**
+ * Compact representation of a diff: the different and anti-aliased pixels as runs, without the
+ * grayscale background. Much smaller than the diff image when few pixels differ, and can be
+ * rendered to the usual diff image with \ref renderSparseDiff.
+ */
+struct SparseDiff {
+  int32_t width = 0;          //!< Width of the compared images, in pixels.
+  int32_t height = 0;         //!< Height of the compared images, in pixels.
+  std::vector<DiffRun> runs;  //!< Runs sorted by row then column, without overlaps.
+};
+
+/**
+ * Compares two images like \ref pixelmatch, and records the different and anti-aliased pixels as
+ * runs during the comparison instead of drawing a diff image.
+ *
+ * @param img1 First image, see \ref pixelmatch.
+ * @param img2 Second image, must be the same size as img1.
+ * @param width in pixels, must be > 0.
+ * @param height in pixels, must be > 0.
+ * @param strideInPixels Stride of the image, in pixels, must be >= width.
+ * @param diff Set to the sparse diff. The capacity of its runs is reused between calls.
+ * @param options Configuration options for the pixel comparison algorithm. The output options are
+ *                only used when rendering.
+ * @return The number of different pixels, or -1 if a precondition fails or the runs could not be
+ *         allocated.
+ */
+int pixelmatchSparse(span<const uint8_t> img1, span<const uint8_t> img2, int width, int height,
+                     size_t strideInPixels, SparseDiff& diff, Options options = Options()) noexcept;
+
+/**
+ * Draws the diff image that \ref pixelmatch would have produced from a sparse diff and the first
+ * image: the runs in their colors, over img1 in grayscale unless Options::diffMask is set.
+ * Options::heatmap is not supported, different pixels use the diff colors.
+ *
+ * @param diff Sparse diff, from \ref pixelmatchSparse or \ref decodeSparseDiff.
+ * @param img1 First image of the comparison, of diff.width x diff.height pixels.
+ * @param strideInPixels Stride of img1 and output, in pixels, must be >= diff.width.
+ * @param output Output image buffer, of the same size as img1.
+ * @param options Output options, should match those of the comparison.
+ * @return true on success, false if a precondition fails or the runs are out of order or bounds.
+ */
+bool renderSparseDiff(const SparseDiff& diff, span<const uint8_t> img1, size_t strideInPixels,
+                      span<uint8_t> output, Options options = Options()) noexcept;
+
+/**
+ * Serializes a sparse diff to a compact binary format, for storage or transport.
+ *
+ * The format is the magic "PMSD", a version byte, then the width, height and number of runs as
+ * LEB128 varints, followed by each run as three varints: the row delta from the previous run, the
+ * column (relative to the end of the previous run if on the same row), and (length - 1) * 3 +
+ * kind.
+ *
+ * @param diff Sparse diff to encode, with runs in order.
+ * @param encoded Set to the encoded bytes. Its capacity is reused between calls.
+ * @return true on success, false if the runs are out of order or bounds, or allocation failed.
+ */
+bool encodeSparseDiff(const SparseDiff& diff, std::vector<uint8_t>& encoded) noexcept;
+
+/**
+ * Deserializes a sparse diff written by \ref encodeSparseDiff.
+ *
+ * @return The sparse diff, or std::nullopt if the data is truncated, malformed, or describes runs
+ *         out of order or bounds.
+ */
+std::optional<SparseDiff> decodeSparseDiff(span<const uint8_t> encoded) noexcept;
+
+/**
+ * Integer translation between two images, see \ref estimateTranslation.
+ */
+struct Translation {
+  int dx = 0;  //!< Horizontal shift, positive if the content of img2 is to the right of img1.
+  int dy = 0;  //!< Vertical shift, positive if the content of img2 is below img1.
+};
+
+/**
+ * Estimates a global integer translation between two images, such that pixel (x, y) of img1
+ * corresponds to pixel (x + dx, y + dy) of img2, from the row and column brightness projections of
+ * both images.
+ *
+ * @param img1 First image, see \ref pixelmatch.
+ * @param img2 Second image, must be the same size as img1.
+ * @param width in pixels, must be > 0.
+ * @param height in pixels, must be > 0.
+ * @param strideInPixels Stride of the image, in pixels, must be >= width.
+ * @param maxShift Maximum shift to search for in each direction, in pixels.
+ * @return The estimated translation, or std::nullopt if a precondition fails or memory
+ *         cannot be allocated.
+ */
+std::optional<Translation> estimateTranslation(span<const uint8_t> img1,
+                                               span<const uint8_t> img2, int width, int height,
+                                               size_t strideInPixels, int maxShift) noexcept;
+
+/**
+ * Result of \ref pixelmatchAligned.
+ */
+struct AlignedResult {
+  int diff = 0;             //!< Number of different pixels after compensating for the shift.
+  Translation translation;  //!< The shift that was compensated for, zero if none was applied.
+};
+
+/**
+ * Compares two images like \ref pixelmatch, after detecting and compensating for a small global
+ * shift between them with \ref estimateTranslation.
+ *
+ * Pixel (x, y) of img1 is compared against pixel (x + dx, y + dy) of img2. Pixels of img1 which
+ * have no counterpart in img2 after shifting are counted as different. The output is drawn in the
+ * coordinates of img1.
+ *
+ * The detected shift is only applied if it reduces the diff by at least 10% compared to comparing
+ * without a shift, otherwise the result is the same as \ref pixelmatch with a zero translation.
+ * This guards against spurious shifts on mostly uniform images.
+ *
+ * @param img1 First image, see \ref pixelmatch.
+ * @param img2 Second image, must be the same size as img1.
+ * @param output (Optional) Output image buffer, of the same size as img1, or an empty span.
+ * @param width in pixels, must be > 0.
+ * @param height in pixels, must be > 0.
+ * @param strideInPixels Stride of the image, in pixels, must be >= width.
+ * @param maxShift Maximum shift to search for in each direction, in pixels.
+ * @param options Configuration options for the pixel comparison algorithm.
+ * @return The result, or std::nullopt if a precondition fails or memory cannot be
+ *         allocated.
+ */
+std::optional<AlignedResult> pixelmatchAligned(span<const uint8_t> img1,
+                                               span<const uint8_t> img2, span<uint8_t> output,
+                                               int width, int height, size_t strideInPixels,
+                                               int maxShift, Options options = Options()) noexcept;
+
+/**
+ * Result of \ref findSubImage.
+ */
+struct SubImageMatch {
+  int x = 0;     //!< Horizontal offset of the sub-image inside the image, in pixels.
+  int y = 0;     //!< Vertical offset of the sub-image inside the image, in pixels.
+  int diff = 0;  //!< Number of different pixels between the sub-image and the image at the offset.
+};
+
+/**
+ * Locates a smaller image inside a larger one, such as a component render inside a full-page
+ * screenshot, and compares it against the best matching region.
+ *
+ * The offset minimizing the summed YIQ color difference is found with a coarse-to-fine search,
+ * then the sub-image is compared against the region at that offset exactly like \ref pixelmatch
+ * would compare it against a crop of the image.
+ *
+ * @param img Image to search in, see \ref pixelmatch.
+ * @param width Width of img in pixels, must be > 0.
+ * @param height Height of img in pixels, must be > 0.
+ * @param strideInPixels Stride of img, in pixels, must be >= width.
+ * @param subImg Image to search for, see \ref pixelmatch.
+ * @param subWidth Width of subImg in pixels, must be > 0 and <= width.
+ * @param subHeight Height of subImg in pixels, must be > 0 and <= height.
+ * @param subStrideInPixels Stride of subImg, in pixels, must be >= subWidth.
+ * @param output (Optional) Output image buffer, of the same size as subImg, or an empty span.
+ * @param options Configuration options for the pixel comparison algorithm.
+ * @return The offset and diff count, or std::nullopt if a precondition fails or memory cannot be
+ *         allocated.
+ */
+std::optional<SubImageMatch> findSubImage(span<const uint8_t> img, int width, int height,
+                                          size_t strideInPixels, span<const uint8_t> subImg,
+                                          int subWidth, int subHeight, size_t subStrideInPixels,
+                                          span<uint8_t> output,
+                                          Options options = Options()) noexcept;
+
+/**
+ * Options for the sampled comparison used by \ref estimatePixelmatch.
+ */
+struct SampleOptions {
+  int cellSize = 4;  //!< Sample one pixel per cellSize x cellSize cell; 4 evaluates 1/16 of pixels
+  float confidenceZ = 3.0f;  //!< z-score of the confidence interval; 3.0 is about 99.7%
+};
+
+/**
+ * Estimated number of different pixels, from \ref estimatePixelmatch.
+ */
+struct DiffEstimate {
+  int sampledPixels = 0;       //!< Number of pixels evaluated.
+  int sampledDiff = 0;         //!< Number of evaluated pixels that were different.
+  double estimatedDiff = 0.0;  //!< Estimated number of different pixels in the full image.
+  double lowerBound = 0.0;     //!< Lower bound of the confidence interval for the diff count.
+  double upperBound = 0.0;     //!< Upper bound of the confidence interval for the diff count.
+};
+
+/**
+ * Estimates the result of \ref pixelmatch by only comparing a deterministic, stratified sample of
+ * pixels: the image is divided into cells and one jittered pixel is evaluated per cell. Each
+ * sampled pixel is classified exactly as \ref pixelmatch would, including anti-aliasing detection.
+ *
+ * @param img1 First image, see \ref pixelmatch.
+ * @param img2 Second image, must be the same size as img1.
+ * @param width in pixels, must be > 0.
+ * @param height in pixels, must be > 0.
+ * @param strideInPixels Stride of the image, in pixels, must be >= width.
+ * @param options Configuration options for the pixel comparison algorithm.
+ * @param sampleOptions Configuration for the sampling.
+ * @return The estimate, or std::nullopt if a precondition fails.
+ */
+std::optional<DiffEstimate> estimatePixelmatch(span<const uint8_t> img1,
+                                               span<const uint8_t> img2, int width, int height,
+                                               size_t strideInPixels, Options options = Options(),
+                                               SampleOptions sampleOptions = SampleOptions()) noexcept;
+
+/**
+ * Result of \ref pixelmatchQuickCheck.
+ */
+struct QuickCheckResult {
+  bool exceedsAllowedDiff = false;  //!< Whether the diff count is above the allowed count.
+  bool exact = false;               //!< true if the full comparison was run, so diff is exact.
+  int diff = 0;                     //!< Number of different pixels, estimated unless exact.
+  DiffEstimate estimate;            //!< The sampled estimate.
+};
+
+/**
+ * Checks whether two images differ by more than \ref allowedDiff pixels, using
+ * \ref estimatePixelmatch and only escalating to the full \ref pixelmatch when the confidence
+ * interval of the estimate contains \ref allowedDiff.
+ *
+ * With an \ref allowedDiff of 0, the estimate cannot rule out a small number of differences, so it
+ * only saves time when the images are identical, which is checked exactly first, or when a sampled
+ * pixel is different. Otherwise the full comparison runs.
+ *
+ * @param img1 First image, see \ref pixelmatch.
+ * @param img2 Second image, must be the same size as img1.
+ * @param width in pixels, must be > 0.
+ * @param height in pixels, must be > 0.
+ * @param strideInPixels Stride of the image, in pixels, must be >= width.
+ * @param allowedDiff Maximum number of different pixels for the images to be considered matching.
+ * @param options Configuration options for the pixel comparison algorithm.
+ * @param sampleOptions Configuration for the sampling.
+ * @return The result, or std::nullopt if a precondition fails.
+ */
+std::optional<QuickCheckResult> pixelmatchQuickCheck(
+    span<const uint8_t> img1, span<const uint8_t> img2, int width, int height,
+    size_t strideInPixels, int allowedDiff, Options options = Options(),
+    SampleOptions sampleOptions = SampleOptions()) noexcept;
+
 }  // namespace pixelmatch
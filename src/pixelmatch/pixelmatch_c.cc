@@ -0,0 +1,95 @@
+#include "pixelmatch/pixelmatch_c.h"
+
+#include <cstddef>  // For offsetof.
+
+#include "pixelmatch/pixelmatch.h"
+
+namespace pixelmatch {
+namespace {
+
+Color toColor(pixelmatch_color color) noexcept {
+  return Color{color.r, color.g, color.b, color.a};
+}
+
+pixelmatch_color fromColor(Color color) noexcept {
+  return pixelmatch_color{color.r, color.g, color.b, color.a};
+}
+
+/// Returns true if \ref field is present in a struct of \ref structSize bytes.
+#define PIXELMATCH_C_HAS_FIELD(structSize, field) \
+  ((structSize) >= offsetof(pixelmatch_options, field) + sizeof(pixelmatch_options::field))
+
+Options toOptions(const pixelmatch_options& c) noexcept {
+  Options options;
+  const size_t size = c.struct_size;
+
+  if (PIXELMATCH_C_HAS_FIELD(size, threshold)) {
+    options.threshold = c.threshold;
+  }
+  if (PIXELMATCH_C_HAS_FIELD(size, include_aa)) {
+    options.includeAA = c.include_aa != 0;
+  }
+  if (PIXELMATCH_C_HAS_FIELD(size, alpha)) {
+    options.alpha = c.alpha;
+  }
+  if (PIXELMATCH_C_HAS_FIELD(size, aa_color)) {
+    options.aaColor = toColor(c.aa_color);
+  }
+  if (PIXELMATCH_C_HAS_FIELD(size, diff_color)) {
+    options.diffColor = toColor(c.diff_color);
+  }
+  if (PIXELMATCH_C_HAS_FIELD(size, diff_color_alt) && c.has_diff_color_alt) {
+    options.diffColorAlt = toColor(c.diff_color_alt);
+  }
+  if (PIXELMATCH_C_HAS_FIELD(size, diff_mask)) {
+    options.diffMask = c.diff_mask != 0;
+  }
+  if (PIXELMATCH_C_HAS_FIELD(size, tile_size)) {
+    options.tileSize = c.tile_size;
+  }
+
+  return options;
+}
+
+#undef PIXELMATCH_C_HAS_FIELD
+
+}  // namespace
+}  // namespace pixelmatch
+
+extern "C" {
+
+void pixelmatch_options_init(pixelmatch_options* options) {
+  if (!options) {
+    return;
+  }
+
+  const pixelmatch::Options defaults;
+  options->struct_size = sizeof(pixelmatch_options);
+  options->threshold = defaults.threshold;
+  options->include_aa = defaults.includeAA ? 1 : 0;
+  options->alpha = defaults.alpha;
+  options->aa_color = pixelmatch::fromColor(defaults.aaColor);
+  options->diff_color = pixelmatch::fromColor(defaults.diffColor);
+  options->has_diff_color_alt = defaults.diffColorAlt ? 1 : 0;
+  options->diff_color_alt =
+      pixelmatch::fromColor(defaults.diffColorAlt.value_or(defaults.diffColor));
+  options->diff_mask = defaults.diffMask ? 1 : 0;
+  options->tile_size = defaults.tileSize;
+}
+
+int pixelmatch_compare(const uint8_t* img1, const uint8_t* img2, uint8_t* output,
+                       size_t image_size, int width, int height, size_t stride_in_pixels,
+                       const pixelmatch_options* options) {
+  if (!img1 || !img2) {
+    return -1;
+  }
+
+  return pixelmatch::pixelmatch(
+      pixelmatch::span<const uint8_t>(img1, image_size),
+      pixelmatch::span<const uint8_t>(img2, image_size),
+      output ? pixelmatch::span<uint8_t>(output, image_size) : pixelmatch::span<uint8_t>(), width,
+      height, stride_in_pixels,
+      options ? pixelmatch::toOptions(*options) : pixelmatch::Options());
+}
+
+}  // extern "C"
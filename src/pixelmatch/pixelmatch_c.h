@@ -0,0 +1,83 @@
+#pragma once
+
+/**
+ * C API for pixelmatch, for use from other languages through an FFI.
+ *
+ * All types in this header are plain C structs with a stable layout, so image buffers can be
+ * passed without copying. Link against the `pixelmatch_c` shared library.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if defined(PIXELMATCH_C_BUILDING)
+#define PIXELMATCH_C_EXPORT __declspec(dllexport)
+#else
+#define PIXELMATCH_C_EXPORT __declspec(dllimport)
+#endif
+#else
+#define PIXELMATCH_C_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * RGBA-ordered 32-bit color.
+ */
+typedef struct pixelmatch_color {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+  uint8_t a;
+} pixelmatch_color;
+
+/**
+ * Pixelmatch options, see pixelmatch::Options for a description of each field.
+ *
+ * Always initialize with \ref pixelmatch_options_init before setting fields. New fields are only
+ * ever appended, and \ref struct_size lets the library detect callers built against an older
+ * version of this header and use defaults for any fields they do not know about.
+ */
+typedef struct pixelmatch_options {
+  uint32_t struct_size;             //!< Set to sizeof(pixelmatch_options) by the init function.
+  float threshold;                  //!< Matching threshold (0 to 1).
+  int32_t include_aa;               //!< Non-zero to include anti-aliased pixels in the diff.
+  float alpha;                      //!< Opacity of original image in diff output.
+  pixelmatch_color aa_color;        //!< Color of anti-aliased pixels in diff output.
+  pixelmatch_color diff_color;      //!< Color of different pixels in diff output.
+  int32_t has_diff_color_alt;       //!< Non-zero to use \ref diff_color_alt.
+  pixelmatch_color diff_color_alt;  //!< Color for dark on light differences.
+  int32_t diff_mask;                //!< Non-zero to draw the diff over a transparent background.
+  int32_t tile_size;                //!< Tile size for traversal, or 0 for row by row.
+} pixelmatch_options;
+
+/**
+ * Initialize \ref options with the default values.
+ */
+PIXELMATCH_C_EXPORT void pixelmatch_options_init(pixelmatch_options* options);
+
+/**
+ * Compares two images, see pixelmatch::pixelmatch.
+ *
+ * @param img1 First image, as a raw RGBA-ordered pixel buffer of \ref image_size bytes.
+ * @param img2 Second image, of \ref image_size bytes.
+ * @param output (Optional) Output image buffer of \ref image_size bytes, or NULL.
+ * @param image_size Size of each image buffer in bytes, must be stride_in_pixels * height * 4.
+ * @param width in pixels, must be > 0.
+ * @param height in pixels, must be > 0.
+ * @param stride_in_pixels Stride of the images, in pixels, must be >= width.
+ * @param options Options, or NULL to use defaults.
+ * @return 0 if the images are identical or the number of different pixels if not. If a precondition
+ *         fails, returns -1.
+ */
+PIXELMATCH_C_EXPORT int pixelmatch_compare(const uint8_t* img1, const uint8_t* img2,
+                                           uint8_t* output, size_t image_size, int width,
+                                           int height, size_t stride_in_pixels,
+                                           const pixelmatch_options* options);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
@@ -0,0 +1,64 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <filesystem>
+
+#include "tools/comparison_service.h"
+
+namespace pixelmatch {
+
+TEST(ComparisonService, Compare) {
+  ComparisonService service(64 * 1024 * 1024);
+
+  EXPECT_EQ(service.handleRequest("COMPARE\ttests/testdata/1a.png\ttests/testdata/1b.png\t"
+                                  "threshold=0.05"),
+            "OK 143");
+  EXPECT_EQ(service.handleRequest("COMPARE\ttests/testdata/1a.png\ttests/testdata/1a.png\r"),
+            "OK 0");
+
+  const size_t goldenBytes = readRgbaImageFromPngFile("tests/testdata/1a.png")->data.size();
+  EXPECT_EQ(service.handleRequest("STATS"),
+            "OK hits=1 misses=1 evictions=0 entries=1 bytes=" + std::to_string(goldenBytes));
+}
+
+TEST(ComparisonService, WritesDiff) {
+  ComparisonService service(64 * 1024 * 1024);
+  const std::filesystem::path diffFilename =
+      std::filesystem::temp_directory_path() / "comparison_service_diff.png";
+
+  EXPECT_EQ(service.handleRequest("COMPARE\ttests/testdata/1a.png\ttests/testdata/1b.png\t"
+                                  "threshold=0.05\tdiff=" +
+                                  diffFilename.string()),
+            "OK 143");
+
+  std::optional<Image> diff = readRgbaImageFromPngFile(diffFilename.c_str());
+  std::optional<Image> expected = readRgbaImageFromPngFile("tests/testdata/1diff.png");
+  std::filesystem::remove(diffFilename);
+
+  ASSERT_TRUE(diff.has_value());
+  ASSERT_TRUE(expected.has_value());
+  EXPECT_TRUE(imageEquals(diff->data, expected->data, expected->width, expected->height,
+                          expected->strideInPixels));
+}
+
+TEST(ComparisonService, Errors) {
+  ComparisonService service(64 * 1024 * 1024);
+
+  EXPECT_THAT(service.handleRequest(""), testing::StartsWith("ERROR"));
+  EXPECT_THAT(service.handleRequest("COMPARE\ttests/testdata/1a.png"),
+              testing::StartsWith("ERROR"));
+  EXPECT_THAT(service.handleRequest("COMPARE\tmissing.png\ttests/testdata/1a.png"),
+              testing::StartsWith("ERROR failed to load golden"));
+  EXPECT_THAT(service.handleRequest("COMPARE\ttests/testdata/1a.png\tmissing.png"),
+              testing::StartsWith("ERROR failed to load candidate"));
+  EXPECT_THAT(service.handleRequest("COMPARE\ttests/testdata/1a.png\ttests/testdata/2a.png"),
+              testing::StartsWith("ERROR image sizes do not match"));
+  EXPECT_THAT(
+      service.handleRequest("COMPARE\ttests/testdata/1a.png\ttests/testdata/1b.png\tthreshold=x"),
+      testing::StartsWith("ERROR invalid threshold"));
+  EXPECT_THAT(
+      service.handleRequest("COMPARE\ttests/testdata/1a.png\ttests/testdata/1b.png\tfoo=1"),
+      testing::StartsWith("ERROR unknown option"));
+}
+
+}  // namespace pixelmatch
@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string>
+
+#include "pixelmatch/image_utils.h"
+#include "pixelmatch_reference.h"
+#include "pixelmatch_variants.h"
+#include "synthetic_images.h"
+
+namespace pixelmatch {
+
+/// Compare every optimized variant against the reference implementation, with the given options.
+void expectVariantsMatchReference(span<const uint8_t> img1, span<const uint8_t> img2, int width,
+                                  int height, size_t strideInPixels, const Options& options) {
+  std::vector<uint8_t> expectedOutput(img1.size(), 0);
+  const int expectedDiff = reference::pixelmatch(img1, img2, expectedOutput, width, height,
+                                                 strideInPixels, options);
+
+  for (const VariantResult& result :
+       runPixelmatchVariants(img1, img2, width, height, strideInPixels, options)) {
+    SCOPED_TRACE(result.name);
+
+    EXPECT_EQ(result.diff, expectedDiff);
+    if (result.hasOutput) {
+      // Report the first mismatching byte, rather than the whole image.
+      const auto mismatch =
+          std::mismatch(result.output.begin(), result.output.end(), expectedOutput.begin());
+      EXPECT_TRUE(mismatch.first == result.output.end())
+          << "output differs at byte " << (mismatch.first - result.output.begin());
+    }
+  }
+}
+
+Options randomOptions(Random& random) {
+  constexpr float kThresholds[] = {0.0f, 0.005f, 0.05f, 0.1f, 0.2f, 0.5f, 1.0f};
+
+  Options options;
+  options.threshold = kThresholds[random.nextInt(static_cast<int>(std::size(kThresholds)))];
+  options.includeAA = random.nextBool();
+  options.alpha = static_cast<float>(random.nextInt(101)) / 100.0f;
+  options.aaColor = Color{random.nextByte(), random.nextByte(), random.nextByte(), 255};
+  options.diffColor = Color{random.nextByte(), random.nextByte(), random.nextByte(), 255};
+  if (random.nextBool()) {
+    options.diffColorAlt = Color{random.nextByte(), random.nextByte(), random.nextByte(), 255};
+  }
+  options.diffMask = random.nextBool();
+  return options;
+}
+
+TEST(Differential, SyntheticImages) {
+  constexpr int kCases = 12;
+
+  for (uint64_t seed = 0; seed < kCases; ++seed) {
+    Random random(seed);
+    const int width = 256 + random.nextInt(768);
+    const int height = 128 + random.nextInt(384);
+    const size_t strideInPixels = width + (random.nextBool() ? 0 : random.nextInt(64));
+    const SyntheticDiff kind = static_cast<SyntheticDiff>(random.nextInt(3));
+    const bool alpha = random.nextBool();
+    const Options options = randomOptions(random);
+
+    SCOPED_TRACE(testing::Message()
+                 << "seed=" << seed << ", " << width << "x" << height << ", stride="
+                 << strideInPixels << ", " << syntheticDiffName(kind) << ", alpha=" << alpha
+                 << ", threshold=" << options.threshold << ", includeAA=" << options.includeAA
+                 << ", diffMask=" << options.diffMask);
+
+    const SyntheticImagePair images =
+        generateSyntheticImagePair(width, height, strideInPixels, kind, seed, alpha);
+    expectVariantsMatchReference(images.img1, images.img2, width, height, strideInPixels,
+                                 options);
+  }
+}
+
+TEST(Differential, RandomAlpha) {
+  // Sparse random changes to the color and alpha of single pixels, including fully transparent
+  // ones, over an image with random alpha.
+  Random random(42);
+  const int width = 333;
+  const int height = 207;
+  const size_t strideInPixels = 350;
+
+  const SyntheticImagePair images =
+      generateSyntheticImagePair(width, height, strideInPixels, SyntheticDiff::kSparse, 42, true);
+  std::vector<uint8_t> img1 = images.img1;
+  std::vector<uint8_t> img2 = images.img2;
+  for (int i = 0; i < width * height / 8; ++i) {
+    const size_t pos =
+        (random.nextInt(height) * strideInPixels + random.nextInt(width)) * 4 + random.nextInt(4);
+    (random.nextBool() ? img1 : img2)[pos] = random.nextBool() ? 0 : random.nextByte();
+  }
+
+  for (int i = 0; i < 8; ++i) {
+    const Options options = randomOptions(random);
+    SCOPED_TRACE(testing::Message() << "options " << i << ", threshold=" << options.threshold
+                                    << ", includeAA=" << options.includeAA);
+    expectVariantsMatchReference(img1, img2, width, height, strideInPixels, options);
+  }
+}
+
+TEST(Differential, TestData) {
+  for (const char* name : {"1", "2", "3", "4", "5", "6", "7"}) {
+    SCOPED_TRACE(name);
+
+    const std::string prefix = std::string("tests/testdata/") + name;
+    const std::optional<Image> img1 = readRgbaImageFromPngFile((prefix + "a.png").c_str());
+    const std::optional<Image> img2 = readRgbaImageFromPngFile((prefix + "b.png").c_str());
+    ASSERT_TRUE(img1.has_value());
+    ASSERT_TRUE(img2.has_value());
+
+    for (const bool includeAA : {false, true}) {
+      Options options;
+      options.includeAA = includeAA;
+      options.diffColorAlt = Color{0, 255, 0, 255};
+      expectVariantsMatchReference(img1->data, img2->data, img1->width, img1->height,
+                                   img1->strideInPixels, options);
+    }
+  }
+}
+
+}  // namespace pixelmatch
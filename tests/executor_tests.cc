@@ -0,0 +1,169 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "pixelmatch/executor.h"
+#include "pixelmatch/parallel_algorithms_executor.h"
+
+namespace pixelmatch {
+
+/// Minimal fixed-size thread pool, standing in for a pool owned by the caller.
+class TestThreadPool {
+public:
+  explicit TestThreadPool(size_t numThreads) {
+    for (size_t i = 0; i < numThreads; ++i) {
+      threads_.emplace_back([this]() {
+        while (true) {
+          std::function<void()> task;
+          {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+              return;
+            }
+
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+          }
+
+          task();
+        }
+      });
+    }
+  }
+
+  ~TestThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+
+    cv_.notify_all();
+    for (std::thread& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  void enqueue(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+    }
+
+    cv_.notify_one();
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+/// Runs a loop on the executor, and checks that each index was visited exactly once.
+void expectVisitsEachIndexOnce(Executor& executor, size_t begin, size_t end) {
+  std::vector<std::atomic<int>> visits(end);
+  executor.parallelFor(begin, end, [&](size_t i) noexcept { ++visits[i]; });
+
+  for (size_t i = 0; i < end; ++i) {
+    EXPECT_EQ(visits[i].load(), i >= begin ? 1 : 0) << "index " << i;
+  }
+}
+
+TEST(Executor, Serial) {
+  SerialExecutor executor;
+  expectVisitsEachIndexOnce(executor, 0, 100);
+  expectVisitsEachIndexOnce(executor, 10, 20);
+  expectVisitsEachIndexOnce(executor, 5, 5);
+}
+
+TEST(Executor, Threads) {
+  for (size_t maxThreads : {0, 1, 4, 64}) {
+    SCOPED_TRACE(testing::Message() << "maxThreads=" << maxThreads);
+
+    ThreadExecutor executor(maxThreads);
+    expectVisitsEachIndexOnce(executor, 0, 1000);
+    expectVisitsEachIndexOnce(executor, 10, 13);
+    expectVisitsEachIndexOnce(executor, 5, 5);
+  }
+}
+
+TEST(Executor, Pool) {
+  TestThreadPool pool(3);
+  PoolExecutor executor([&pool](PoolExecutor::Task task) { pool.enqueue(std::move(task)); }, 4);
+  expectVisitsEachIndexOnce(executor, 0, 1000);
+  expectVisitsEachIndexOnce(executor, 10, 13);
+  expectVisitsEachIndexOnce(executor, 5, 5);
+}
+
+TEST(Executor, PoolDoesNotWaitForTasksThatNeverStart) {
+  // A saturated pool, which only runs the submitted tasks after the loop has returned.
+  std::vector<PoolExecutor::Task> deferred;
+  PoolExecutor executor(
+      [&deferred](PoolExecutor::Task task) { deferred.push_back(std::move(task)); }, 4);
+  expectVisitsEachIndexOnce(executor, 0, 100);
+  EXPECT_EQ(deferred.size(), 3u);
+
+  // The late tasks find no work left, and must not touch the loop's stack.
+  for (PoolExecutor::Task& task : deferred) {
+    task();
+  }
+}
+
+TEST(Executor, PoolSubmitFailure) {
+  PoolExecutor executor([](PoolExecutor::Task) { throw std::runtime_error("pool is closed"); },
+                        4);
+  expectVisitsEachIndexOnce(executor, 0, 100);
+}
+
+TEST(Executor, ThreadPool) {
+  for (size_t numThreads : {0, 1, 3}) {
+    SCOPED_TRACE(testing::Message() << "numThreads=" << numThreads);
+
+    ThreadPoolExecutor executor(numThreads);
+    expectVisitsEachIndexOnce(executor, 0, 1000);
+    expectVisitsEachIndexOnce(executor, 10, 13);
+    expectVisitsEachIndexOnce(executor, 5, 5);
+  }
+}
+
+TEST(Executor, ThreadPoolSubmit) {
+  std::atomic<int> completed{0};
+  {
+    ThreadPoolExecutor executor(2);
+    for (int i = 0; i < 100; ++i) {
+      executor.submit([&completed]() noexcept { ++completed; });
+    }
+
+    // Loops can run while tasks are queued, and destruction runs the remaining tasks.
+    expectVisitsEachIndexOnce(executor, 0, 100);
+  }
+
+  EXPECT_EQ(completed.load(), 100);
+}
+
+TEST(Executor, SubmitRunsInlineByDefault) {
+  SerialExecutor executor;
+  bool ran = false;
+  executor.submit([&ran]() noexcept { ran = true; });
+  EXPECT_TRUE(ran);
+}
+
+#if defined(PIXELMATCH_TEST_PARALLEL_ALGORITHMS) && defined(__cpp_lib_execution)
+TEST(Executor, ParallelAlgorithms) {
+  ParallelAlgorithmsExecutor executor;
+  expectVisitsEachIndexOnce(executor, 0, 1000);
+  expectVisitsEachIndexOnce(executor, 10, 13);
+  expectVisitsEachIndexOnce(executor, 5, 5);
+}
+#endif
+
+}  // namespace pixelmatch
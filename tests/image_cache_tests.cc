@@ -0,0 +1,93 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <filesystem>
+
+#include "pixelmatch/image_cache.h"
+
+namespace pixelmatch {
+
+struct AutodeleteFile {
+  AutodeleteFile(std::filesystem::path filename) : filename(std::move(filename)) {}
+  ~AutodeleteFile() { std::filesystem::remove(filename); }
+
+  std::filesystem::path filename;
+};
+
+TEST(ImageCache, HitAndMiss) {
+  ImageCache cache(64 * 1024 * 1024);
+
+  std::shared_ptr<const Image> first = cache.get("tests/testdata/1a.png");
+  ASSERT_NE(first, nullptr);
+  std::shared_ptr<const Image> second = cache.get("tests/testdata/1a.png");
+  EXPECT_EQ(first, second) << "Second lookup should return the cached image";
+
+  const ImageCache::Stats stats = cache.stats();
+  EXPECT_EQ(stats.hits, 1u);
+  EXPECT_EQ(stats.misses, 1u);
+  EXPECT_EQ(stats.entries, 1u);
+  EXPECT_EQ(stats.bytesUsed, first->data.size());
+}
+
+TEST(ImageCache, MissingFile) {
+  ImageCache cache(64 * 1024 * 1024);
+  EXPECT_EQ(cache.get("tests/testdata/does-not-exist.png"), nullptr);
+  EXPECT_EQ(cache.stats().entries, 0u);
+}
+
+TEST(ImageCache, EvictsLeastRecentlyUsed) {
+  const size_t imageBytes = ImageCache(SIZE_MAX).get("tests/testdata/1a.png")->data.size();
+  ASSERT_EQ(ImageCache(SIZE_MAX).get("tests/testdata/1b.png")->data.size(), imageBytes);
+  ASSERT_EQ(ImageCache(SIZE_MAX).get("tests/testdata/1diff.png")->data.size(), imageBytes);
+
+  // Room for two images.
+  ImageCache cache(imageBytes * 2);
+  std::shared_ptr<const Image> a = cache.get("tests/testdata/1a.png");
+  cache.get("tests/testdata/1b.png");
+  cache.get("tests/testdata/1a.png");     // Make 1b the least recently used.
+  cache.get("tests/testdata/1diff.png");  // Evicts 1b.
+
+  ImageCache::Stats stats = cache.stats();
+  EXPECT_EQ(stats.evictions, 1u);
+  EXPECT_EQ(stats.entries, 2u);
+  EXPECT_EQ(stats.bytesUsed, imageBytes * 2);
+
+  EXPECT_EQ(cache.get("tests/testdata/1a.png"), a);
+  EXPECT_EQ(cache.stats().hits, 2u);
+
+  cache.get("tests/testdata/1b.png");
+  EXPECT_EQ(cache.stats().misses, 4u);
+}
+
+TEST(ImageCache, LargerThanBudgetIsNotCached) {
+  ImageCache cache(16);
+  EXPECT_NE(cache.get("tests/testdata/1a.png"), nullptr);
+  EXPECT_EQ(cache.stats().entries, 0u);
+  EXPECT_EQ(cache.stats().bytesUsed, 0u);
+}
+
+TEST(ImageCache, ReloadsModifiedFile) {
+  std::filesystem::path filename = std::filesystem::temp_directory_path() / "image_cache.png";
+  auto autodelete = AutodeleteFile(filename);
+
+  std::filesystem::copy_file("tests/testdata/1a.png", filename,
+                             std::filesystem::copy_options::overwrite_existing);
+
+  ImageCache cache(64 * 1024 * 1024);
+  std::shared_ptr<const Image> original = cache.get(filename.string());
+  ASSERT_NE(original, nullptr);
+
+  std::filesystem::copy_file("tests/testdata/2a.png", filename,
+                             std::filesystem::copy_options::overwrite_existing);
+  std::filesystem::last_write_time(
+      filename, std::filesystem::last_write_time(filename) + std::chrono::seconds(10));
+
+  std::shared_ptr<const Image> modified = cache.get(filename.string());
+  ASSERT_NE(modified, nullptr);
+  EXPECT_NE(modified, original);
+  EXPECT_EQ(cache.stats().misses, 2u);
+  EXPECT_EQ(cache.stats().entries, 1u);
+  EXPECT_EQ(cache.stats().bytesUsed, modified->data.size());
+}
+
+}  // namespace pixelmatch
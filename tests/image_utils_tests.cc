@@ -3,8 +3,11 @@
 #include <gtest/gtest.h>
 
 #include <array>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <iterator>
+#include <memory_resource>
 
 #include "pixelmatch/image_utils.h"
 
@@ -17,6 +20,36 @@ struct AutodeleteFile {
   std::filesystem::path filename;
 };
 
+/// Forwards to an upstream resource, tracking outstanding allocations.
+class CountingResource final : public std::pmr::memory_resource {
+public:
+  explicit CountingResource(
+      std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()) noexcept
+      : upstream_(upstream) {}
+
+  size_t allocations = 0;
+  size_t outstandingBytes = 0;
+
+private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    void* ptr = upstream_->allocate(bytes, alignment);
+    ++allocations;
+    outstandingBytes += bytes;
+    return ptr;
+  }
+
+  void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+    outstandingBytes -= bytes;
+    upstream_->deallocate(ptr, bytes, alignment);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+  std::pmr::memory_resource* upstream_;
+};
+
 TEST(ImageUtils, SaveLoad) {
   constexpr int width = 3;
   constexpr int height = 4;
@@ -83,6 +116,314 @@ TEST(ImageUtils, WriteInvalidFilename) {
   EXPECT_FALSE(writeRgbaPixelsToPngFile(directoryName.c_str(), img, 1, 1, 1));
 }
 
+TEST(ImageUtils, Load16) {
+  auto maybeImg = readRgbaImageFromPngFile("tests/testdata/1a.png");
+  auto maybeImg16 = readRgba16ImageFromPngFile("tests/testdata/1a.png");
+  ASSERT_TRUE(maybeImg.has_value());
+  ASSERT_TRUE(maybeImg16.has_value());
+
+  const Image& img = maybeImg.value();
+  const Image16& img16 = maybeImg16.value();
+  EXPECT_EQ(img16.width, img.width);
+  EXPECT_EQ(img16.height, img.height);
+  EXPECT_EQ(img16.strideInPixels, img.strideInPixels);
+  ASSERT_EQ(img16.data.size(), img.data.size());
+
+  // 8-bit PNGs are expanded to 16 bits by replicating the byte.
+  for (size_t i = 0; i < img.data.size(); ++i) {
+    ASSERT_EQ(img16.data[i], img.data[i] * 257) << "i=" << i;
+  }
+
+  EXPECT_FALSE(readRgba16ImageFromPngFile("tests/testdata/does-not-exist.png").has_value());
+}
+
+TEST(ImageUtils, SaveLoadAsync) {
+  constexpr int width = 3;
+  constexpr int height = 2;
+  constexpr size_t stride = 4;
+
+  std::vector<uint8_t> img(stride * height * 4);
+  for (size_t i = 0; i < img.size(); ++i) {
+    img[i] = static_cast<uint8_t>(i * 7);
+  }
+
+  // Make the pixels outside the image width opaque so that they are distinguishable, but they
+  // should be dropped when saving.
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      img[(y * stride + x) * 4 + 3] = 255;
+    }
+  }
+
+  // Without an executor the operations complete on the calling thread, with a pool many of them
+  // can be in flight on a bounded number of threads.
+  ThreadPoolExecutor pool(2);
+  for (Executor* executor : {static_cast<Executor*>(nullptr), static_cast<Executor*>(&pool)}) {
+    SCOPED_TRACE(testing::Message() << "executor=" << (executor ? "pool" : "none"));
+
+    constexpr size_t kFiles = 8;
+    std::vector<AutodeleteFile> autodelete;
+    autodelete.reserve(kFiles);
+    std::vector<std::future<bool>> writeResults;
+    for (size_t i = 0; i < kFiles; ++i) {
+      autodelete.emplace_back(std::filesystem::temp_directory_path() /
+                              ("async" + std::to_string(i) + ".png"));
+      writeResults.push_back(writeRgbaPixelsToPngFileAsync(
+          autodelete.back().filename.string(), img, width, height, stride, executor));
+    }
+
+    for (std::future<bool>& writeResult : writeResults) {
+      ASSERT_TRUE(writeResult.get());
+    }
+
+    std::vector<std::future<std::optional<Image>>> readResults;
+    for (const AutodeleteFile& file : autodelete) {
+      readResults.push_back(readRgbaImageFromPngFileAsync(file.filename.string(), executor));
+    }
+
+    for (std::future<std::optional<Image>>& readResult : readResults) {
+      std::optional<Image> readImg = readResult.get();
+      ASSERT_TRUE(readImg.has_value());
+      EXPECT_EQ(readImg->width, width);
+      EXPECT_EQ(readImg->height, height);
+      EXPECT_EQ(readImg->strideInPixels, width);
+
+      for (int y = 0; y < height; ++y) {
+        EXPECT_EQ(std::memcmp(&readImg->data[y * width * 4], &img[y * stride * 4], width * 4), 0)
+            << "y=" << y;
+      }
+    }
+  }
+}
+
+TEST(ImageUtils, ReadMissingFileAsync) {
+  std::filesystem::path missingFilename =
+      std::filesystem::temp_directory_path() / "does-not-exist.png";
+
+  EXPECT_FALSE(readRgbaImageFromPngFileAsync(missingFilename.string()).get().has_value());
+
+  ThreadPoolExecutor pool(1);
+  EXPECT_FALSE(
+      readRgbaImageFromPngFileAsync(missingFilename.string(), &pool).get().has_value());
+}
+
+TEST(ImageUtils, EncodeDecodeMemory) {
+  std::array<uint8_t, 8> img{10, 20, 30, 255, 40, 50, 60, 128};
+
+  std::optional<std::vector<uint8_t>> encoded = writeRgbaPixelsToPngMemory(img, 2, 1, 2);
+  ASSERT_TRUE(encoded.has_value());
+
+  std::optional<Image> decoded = readRgbaImageFromPngMemory(encoded.value());
+  ASSERT_TRUE(decoded.has_value());
+  EXPECT_EQ(decoded->width, 2);
+  EXPECT_EQ(decoded->height, 1);
+  EXPECT_TRUE(imageEquals(decoded->data, img, 2, 1, 2));
+
+  const std::array<uint8_t, 7> invalid{'i', 'n', 'v', 'a', 'l', 'i', 'd'};
+  EXPECT_FALSE(readRgbaImageFromPngMemory(invalid).has_value());
+}
+
+TEST(ImageUtils, SaveLoadStriped) {
+  constexpr int width = 5;
+  constexpr int height = 11;
+  constexpr size_t stride = 7;
+
+  std::vector<uint8_t> img(stride * height * 4);
+  for (size_t i = 0; i < img.size(); ++i) {
+    img[i] = static_cast<uint8_t>(i * 13 + 5);
+  }
+
+  std::filesystem::path savedFilename = std::filesystem::temp_directory_path() / "striped.pxms";
+  auto autodelete = AutodeleteFile(savedFilename);
+
+  // Use a strip height that does not divide the image height, to cover a partial last strip.
+  ASSERT_TRUE(writeRgbaPixelsToStripedPngFile(savedFilename.c_str(), img, width, height, stride,
+                                              /*rowsPerStrip=*/4));
+
+  std::optional<Image> readImg = readRgbaImageFromStripedPngFile(savedFilename.c_str());
+  ASSERT_TRUE(readImg.has_value());
+  EXPECT_EQ(readImg->width, width);
+  EXPECT_EQ(readImg->height, height);
+  EXPECT_EQ(readImg->strideInPixels, width);
+
+  for (int y = 0; y < height; ++y) {
+    EXPECT_EQ(std::memcmp(&readImg->data[y * width * 4], &img[y * stride * 4], width * 4), 0)
+        << "y=" << y;
+  }
+}
+
+TEST(ImageUtils, StripedUsesExecutor) {
+  // Runs loops serially, counting the indices it was given.
+  class CountingExecutor final : public Executor {
+  public:
+    void parallelFor(size_t begin, size_t end,
+                     const std::function<void(size_t)>& fn) noexcept override {
+      indices += end - begin;
+      SerialExecutor().parallelFor(begin, end, fn);
+    }
+
+    size_t indices = 0;
+  };
+
+  constexpr int width = 3;
+  constexpr int height = 10;
+  const std::vector<uint8_t> img(width * height * 4, 128);
+
+  std::filesystem::path savedFilename = std::filesystem::temp_directory_path() / "executor.pxms";
+  auto autodelete = AutodeleteFile(savedFilename);
+
+  CountingExecutor executor;
+  ASSERT_TRUE(writeRgbaPixelsToStripedPngFile(savedFilename.c_str(), img, width, height, width,
+                                              /*rowsPerStrip=*/3, &executor));
+  EXPECT_EQ(executor.indices, 4u);
+
+  std::optional<Image> readImg = readRgbaImageFromStripedPngFile(savedFilename.c_str(), &executor);
+  ASSERT_TRUE(readImg.has_value());
+  EXPECT_EQ(readImg->data, img);
+  EXPECT_EQ(executor.indices, 8u);
+}
+
+TEST(ImageUtils, PngMemoryResource) {
+  CountingResource resource;
+  {
+    const ScopedPngMemoryResource scopedResource(&resource);
+
+    std::optional<Image> img = readRgbaImageFromPngFile("tests/testdata/1a.png");
+    ASSERT_TRUE(img.has_value());
+    const size_t decodeAllocations = resource.allocations;
+    EXPECT_GT(decodeAllocations, 0u);
+
+    EXPECT_TRUE(writeRgbaPixelsToPngMemory(img->data, img->width, img->height,
+                                           img->strideInPixels)
+                    .has_value());
+    EXPECT_GT(resource.allocations, decodeAllocations);
+
+    // 16-bit reads use the resource too, for both the file contents and the decoded pixels.
+    const size_t encodeAllocations = resource.allocations;
+    EXPECT_TRUE(readRgba16ImageFromPngFile("tests/testdata/1a.png").has_value());
+    EXPECT_GT(resource.allocations, encodeAllocations);
+
+    // Async reads allocate the file contents from the resource too, like synchronous reads.
+    const size_t syncStart = resource.allocations;
+    EXPECT_TRUE(readRgbaImageFromPngFile("tests/testdata/1a.png").has_value());
+    const size_t asyncStart = resource.allocations;
+    EXPECT_TRUE(readRgbaImageFromPngFileAsync("tests/testdata/1a.png").get().has_value());
+    EXPECT_EQ(resource.allocations - asyncStart, asyncStart - syncStart);
+  }
+
+  EXPECT_EQ(resource.outstandingBytes, 0u);
+
+  // The previous resource is restored.
+  const size_t allocations = resource.allocations;
+  EXPECT_TRUE(readRgbaImageFromPngFile("tests/testdata/1a.png").has_value());
+  EXPECT_EQ(resource.allocations, allocations);
+}
+
+TEST(ImageUtils, SteadyStateDoesNotAllocate) {
+  const std::filesystem::path savedFilename =
+      std::filesystem::temp_directory_path() / "steady_state.png";
+  auto autodelete = AutodeleteFile(savedFilename);
+  const std::string savedFilenameString = savedFilename.string();
+
+  // Buffers reused across iterations, and an arena for the PNG internals of each iteration. The
+  // arena has no upstream, so any PNG allocation beyond it fails the iteration.
+  Image img1{};
+  Image img2{};
+  std::vector<uint8_t> output;
+  std::vector<uint8_t> encoded;
+  std::vector<std::byte> arenaBuffer(64 * 1024 * 1024);
+  std::array<const uint8_t*, 4> buffers{};
+
+  for (int iteration = 0; iteration < 2; ++iteration) {
+    SCOPED_TRACE(testing::Message() << "iteration=" << iteration);
+
+    std::pmr::monotonic_buffer_resource arena(arenaBuffer.data(), arenaBuffer.size(),
+                                              std::pmr::null_memory_resource());
+    CountingResource resource(&arena);
+    {
+      const ScopedPngMemoryResource scopedResource(&resource);
+
+      ASSERT_TRUE(readRgbaImageFromPngFile("tests/testdata/1a.png", img1));
+      ASSERT_TRUE(readRgbaImageFromPngFile("tests/testdata/1b.png", img2));
+      output.resize(img1.data.size());
+      EXPECT_GT(pixelmatch(img1.data, img2.data, output, img1.width, img1.height,
+                           img1.strideInPixels),
+                0);
+      ASSERT_TRUE(writeRgbaPixelsToPngMemory(output, img1.width, img1.height,
+                                             img1.strideInPixels, encoded));
+      ASSERT_TRUE(writeRgbaPixelsToPngFile(savedFilenameString.c_str(), output, img1.width,
+                                           img1.height, img1.strideInPixels));
+    }
+
+    // The PNG internals allocate from the resource, and release everything they allocate.
+    EXPECT_GT(resource.allocations, 0u);
+    EXPECT_EQ(resource.outstandingBytes, 0u);
+
+    // After the first iteration, the pixel and encoded buffers are reused rather than reallocated.
+    const std::array<const uint8_t*, 4> iterationBuffers = {img1.data.data(), img2.data.data(),
+                                                            output.data(), encoded.data()};
+    if (iteration > 0) {
+      EXPECT_EQ(iterationBuffers, buffers);
+    }
+
+    buffers = iterationBuffers;
+  }
+
+  std::optional<Image> decoded = readRgbaImageFromPngMemory(encoded);
+  ASSERT_TRUE(decoded.has_value());
+  EXPECT_EQ(decoded->data, output);
+}
+
+TEST(ImageUtils, ReadInvalidStriped) {
+  std::filesystem::path savedFilename = std::filesystem::temp_directory_path() / "invalid.pxms";
+  auto autodelete = AutodeleteFile(savedFilename);
+
+  {
+    std::ofstream file(savedFilename.c_str(), std::ios::binary);
+    file << "PXMSTRIP";
+  }
+
+  EXPECT_FALSE(readRgbaImageFromStripedPngFile(savedFilename.c_str()).has_value());
+
+  // A regular PNG is not a striped container.
+  EXPECT_FALSE(readRgbaImageFromStripedPngFile("tests/testdata/1a.png").has_value());
+}
+
+TEST(ImageUtils, ReadStripedRejectsOversizedHeader) {
+  std::filesystem::path savedFilename = std::filesystem::temp_directory_path() / "oversized.pxms";
+  auto autodelete = AutodeleteFile(savedFilename);
+
+  // A valid 1x1 image, with the header patched to claim a huge size.
+  const std::vector<uint8_t> img(4, 128);
+  ASSERT_TRUE(writeRgbaPixelsToStripedPngFile(savedFilename.c_str(), img, 1, 1, 1));
+
+  std::vector<uint8_t> bytes;
+  {
+    std::ifstream file(savedFilename.c_str(), std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+
+  ASSERT_GE(bytes.size(), 28u);
+  const auto writeField = [&bytes](size_t offset, uint32_t value) {
+    for (size_t i = 0; i < 4; ++i) {
+      bytes[offset + i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+  };
+
+  // Width and height of INT_MAX, in a single strip.
+  writeField(12, 0x7FFFFFFF);
+  writeField(16, 0x7FFFFFFF);
+  writeField(20, 0x7FFFFFFF);
+  {
+    std::ofstream file(savedFilename.c_str(), std::ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()),
+               static_cast<std::streamsize>(bytes.size()));
+  }
+
+  // Rejected before allocating the image, instead of terminating on allocation failure.
+  EXPECT_FALSE(readRgbaImageFromStripedPngFile(savedFilename.c_str()).has_value());
+}
+
 TEST(ImageUtils, ImageEquals) {
   std::filesystem::path directoryName = std::filesystem::temp_directory_path();
 
@@ -0,0 +1,357 @@
+/**
+ * End-to-end performance regression harness for pixelmatch and the image_utils load/save paths.
+ *
+ * Runs over a deterministic synthetic corpus (sparse, dense and anti-aliased diffs, at sizes up to
+ * 8K, and each color metric on the dense diff), measures throughput and the peak resident set
+ * size, and compares them against a JSON baseline. Exits with a non-zero status if any throughput
+ * drops, or the peak RSS grows, by more than the tolerance.
+ *
+ * Usage: perf_harness [--baseline=<path>] [--update-baseline] [--tolerance=<f>]
+ *                     [--iterations=<n>] [--quick] [--output=<path>]
+ *
+ * A missing or unreadable baseline is an error; record one with --update-baseline. The baseline
+ * defaults to tests/perf_baseline.json, relative to the workspace when run with `bazel run` and to
+ * the working directory otherwise. Baselines are machine-specific and are not checked in.
+ *
+ * Build with optimizations for meaningful results.
+ */
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "pixelmatch/image_utils.h"
+#include "pixelmatch/pixelmatch.h"
+#include "synthetic_images.h"
+
+namespace pixelmatch {
+namespace {
+
+constexpr const char* kUsage = R"(Usage: perf_harness [options]
+
+Options:
+  --baseline=<path>  Baseline file. Default: tests/perf_baseline.json.
+  --update-baseline  Overwrite the baseline with the current results.
+  --tolerance=<f>    Allowed relative regression, 0 to 1. Default 0.2.
+  --iterations=<n>   Runs per case, the fastest is recorded. Default 3.
+  --quick            Only run the smallest corpus size.
+  --output=<path>    Also write the current results to this file.
+)";
+
+/// Throughput of each case in megapixels per second, and the peak RSS of the run.
+struct PerfResults {
+  std::map<std::string, double> megapixelsPerSecond;
+  long peakRssKb = 0;
+};
+
+struct CorpusSize {
+  int width;
+  int height;
+};
+
+constexpr CorpusSize kCorpusSizes[] = {{1920, 1080}, {3840, 2160}, {7680, 4320}};
+
+/// Peak resident set size of the process so far, in kilobytes.
+long peakRssKb() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  return usage.ru_maxrss / 1024;  // Bytes on macOS.
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+/// Run \ref fn the given number of times, and return the fastest run in milliseconds.
+template <typename Func>
+double bestOfMs(int iterations, const Func& fn) {
+  double bestMs = 0.0;
+  for (int i = 0; i < iterations; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    fn();
+    const double ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+    bestMs = i == 0 ? ms : std::min(bestMs, ms);
+  }
+
+  return bestMs;
+}
+
+double megapixelsPerSecond(int width, int height, double ms) {
+  return static_cast<double>(width) * height / (std::max(ms, 1e-3) * 1000.0);
+}
+
+PerfResults runCorpus(int iterations, bool quick) {
+  PerfResults results;
+  const std::filesystem::path pngFile =
+      std::filesystem::temp_directory_path() / "pixelmatch_perf_harness.png";
+
+  for (const CorpusSize& size : kCorpusSizes) {
+    if (quick && &size != &kCorpusSizes[0]) {
+      break;
+    }
+
+    const std::string sizeName = std::to_string(size.width) + "x" + std::to_string(size.height);
+    std::vector<uint8_t> output(static_cast<size_t>(size.width) * size.height * 4);
+
+    for (SyntheticDiff kind :
+         {SyntheticDiff::kSparse, SyntheticDiff::kDense, SyntheticDiff::kAntialiased}) {
+      const SyntheticImagePair images =
+          generateSyntheticImagePair(size.width, size.height, size.width, kind, /*seed=*/1);
+
+      int diff = 0;
+      const double ms = bestOfMs(iterations, [&]() {
+        diff = pixelmatch(images.img1, images.img2, output, images.width, images.height,
+                          images.strideInPixels);
+      });
+      const std::string name = std::string("pixelmatch/") + syntheticDiffName(kind) + "/" +
+                               sizeName;
+      results.megapixelsPerSecond[name] = megapixelsPerSecond(size.width, size.height, ms);
+      std::printf("%-40s %10.2f ms %10.1f Mpx/s %10d diff\n", name.c_str(), ms,
+                  results.megapixelsPerSecond[name], diff);
+
+      // The perceptual metrics, on the case where most pixels differ and the metric dominates.
+      if (kind == SyntheticDiff::kDense) {
+        const std::pair<const char*, ColorMetric> metrics[] = {
+            {"oklab", ColorMetric::kOklab}, {"ciede2000", ColorMetric::kCiede2000}};
+        for (const auto& [metricName, metric] : metrics) {
+          Options options;
+          options.colorMetric = metric;
+          const double metricMs = bestOfMs(iterations, [&]() {
+            diff = pixelmatch(images.img1, images.img2, output, images.width, images.height,
+                              images.strideInPixels, options);
+          });
+          const std::string metricCase = name + "/" + metricName;
+          results.megapixelsPerSecond[metricCase] =
+              megapixelsPerSecond(size.width, size.height, metricMs);
+          std::printf("%-40s %10.2f ms %10.1f Mpx/s %10d diff\n", metricCase.c_str(), metricMs,
+                      results.megapixelsPerSecond[metricCase], diff);
+        }
+      }
+
+      if (kind != SyntheticDiff::kSparse) {
+        continue;
+      }
+
+      // The load/save paths, on the diff output which is a typical image to save.
+      bool saved = true;
+      const double saveMs = bestOfMs(iterations, [&]() {
+        saved = saved && writeRgbaPixelsToPngFile(pngFile.string().c_str(), output, size.width,
+                                                  size.height, size.width);
+      });
+
+      Image loaded{};
+      bool loadedOk = true;
+      const double loadMs = bestOfMs(iterations, [&]() {
+        loadedOk = loadedOk && readRgbaImageFromPngFile(pngFile.string().c_str(), loaded);
+      });
+
+      if (!saved || !loadedOk || loaded.data != output) {
+        std::fprintf(stderr, "Failed to save and load %s\n", pngFile.string().c_str());
+        std::exit(2);
+      }
+
+      // Comparing to a sparse diff and encoding it, the alternative to saving the diff image.
+      SparseDiff sparseDiff;
+      std::vector<uint8_t> encoded;
+      const double sparseMs = bestOfMs(iterations, [&]() {
+        pixelmatchSparse(images.img1, images.img2, images.width, images.height,
+                         images.strideInPixels, sparseDiff);
+        encodeSparseDiff(sparseDiff, encoded);
+      });
+      const std::string sparseName = "pixelmatchSparse/encode/" + sizeName;
+      results.megapixelsPerSecond[sparseName] =
+          megapixelsPerSecond(size.width, size.height, sparseMs);
+      std::printf("%-40s %10.2f ms %10.1f Mpx/s %10zu bytes\n", sparseName.c_str(), sparseMs,
+                  results.megapixelsPerSecond[sparseName], encoded.size());
+
+      const std::pair<const char*, double> ioTimes[] = {{"save", saveMs}, {"load", loadMs}};
+      for (const auto& [operation, operationMs] : ioTimes) {
+        const std::string ioName = std::string("image_utils/") + operation + "/" + sizeName;
+        results.megapixelsPerSecond[ioName] =
+            megapixelsPerSecond(size.width, size.height, operationMs);
+        std::printf("%-40s %10.2f ms %10.1f Mpx/s\n", ioName.c_str(), operationMs,
+                    results.megapixelsPerSecond[ioName]);
+      }
+    }
+  }
+
+  std::filesystem::remove(pngFile);
+  results.peakRssKb = peakRssKb();
+  std::printf("%-40s %10ld KiB\n", "peak RSS", results.peakRssKb);
+  return results;
+}
+
+/**
+ * Write results as JSON, with one case per line so that the file can be read back by
+ * \ref readResults without a JSON library.
+ */
+bool writeResults(const std::string& path, const PerfResults& results) {
+  std::ofstream out(path);
+  out << "{\n";
+  out << "  \"version\": 1,\n";
+  out << "  \"peakRssKb\": " << results.peakRssKb << ",\n";
+  out << "  \"megapixelsPerSecond\": {\n";
+  size_t i = 0;
+  for (const auto& [name, value] : results.megapixelsPerSecond) {
+    out << "    \"" << name << "\": " << value
+        << (++i < results.megapixelsPerSecond.size() ? ",\n" : "\n");
+  }
+  out << "  }\n";
+  out << "}\n";
+  return out.good();
+}
+
+/// Read results written by \ref writeResults.
+std::optional<PerfResults> readResults(const std::string& path) {
+  std::ifstream in(path);
+  if (!in) {
+    return std::nullopt;
+  }
+
+  PerfResults results;
+  bool inCases = false;
+  std::string line;
+  while (std::getline(in, line)) {
+    const size_t nameStart = line.find('"');
+    const size_t nameEnd = line.find("\":", nameStart + 1);
+    if (nameStart == std::string::npos || nameEnd == std::string::npos) {
+      continue;
+    }
+
+    const std::string name = line.substr(nameStart + 1, nameEnd - nameStart - 1);
+    const std::string value = line.substr(nameEnd + 2);
+    if (name == "megapixelsPerSecond") {
+      inCases = true;
+    } else if (name == "peakRssKb") {
+      results.peakRssKb = std::atol(value.c_str());
+    } else if (inCases) {
+      results.megapixelsPerSecond[name] = std::atof(value.c_str());
+    }
+  }
+
+  return results;
+}
+
+/// Compare against the baseline, printing each regression. Returns true if there are none.
+bool compareResults(const PerfResults& baseline, const PerfResults& current, double tolerance) {
+  bool ok = true;
+  for (const auto& [name, baselineValue] : baseline.megapixelsPerSecond) {
+    const auto it = current.megapixelsPerSecond.find(name);
+    if (it == current.megapixelsPerSecond.end()) {
+      continue;
+    }
+
+    if (it->second < baselineValue * (1.0 - tolerance)) {
+      std::printf("REGRESSION %s: %.1f Mpx/s, baseline %.1f Mpx/s (%+.1f%%)\n", name.c_str(),
+                  it->second, baselineValue, (it->second / baselineValue - 1.0) * 100.0);
+      ok = false;
+    }
+  }
+
+  if (baseline.peakRssKb > 0 &&
+      static_cast<double>(current.peakRssKb) > baseline.peakRssKb * (1.0 + tolerance)) {
+    std::printf("REGRESSION peak RSS: %ld KiB, baseline %ld KiB\n", current.peakRssKb,
+                baseline.peakRssKb);
+    ok = false;
+  }
+
+  return ok;
+}
+
+}  // namespace
+}  // namespace pixelmatch
+
+int main(int argc, char** argv) {
+  using namespace pixelmatch;
+
+  std::string baselinePath = "tests/perf_baseline.json";
+  if (const char* workspace = std::getenv("BUILD_WORKSPACE_DIRECTORY")) {
+    baselinePath = std::string(workspace) + "/" + baselinePath;
+  }
+
+  std::string outputPath;
+  if (const char* outputsDir = std::getenv("TEST_UNDECLARED_OUTPUTS_DIR")) {
+    outputPath = std::string(outputsDir) + "/perf_results.json";
+  }
+
+  bool updateBaseline = false;
+  bool quick = false;
+  double tolerance = 0.2;
+  int iterations = 3;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto value = [&arg](const char* prefix) { return arg.substr(std::strlen(prefix)); };
+
+    if (arg.rfind("--baseline=", 0) == 0) {
+      baselinePath = value("--baseline=");
+    } else if (arg == "--update-baseline") {
+      updateBaseline = true;
+    } else if (arg.rfind("--tolerance=", 0) == 0) {
+      tolerance = std::atof(value("--tolerance=").c_str());
+    } else if (arg.rfind("--iterations=", 0) == 0) {
+      iterations = std::atoi(value("--iterations=").c_str());
+    } else if (arg == "--quick") {
+      quick = true;
+    } else if (arg.rfind("--output=", 0) == 0) {
+      outputPath = value("--output=");
+    } else {
+      std::cerr << kUsage;
+      return 2;
+    }
+  }
+
+  if (iterations <= 0 || tolerance < 0.0) {
+    std::cerr << kUsage;
+    return 2;
+  }
+
+  // Check the baseline before the slow corpus run, so that a missing one fails right away instead
+  // of silently passing.
+  const std::optional<PerfResults> baseline =
+      updateBaseline ? std::nullopt : readResults(baselinePath);
+  if (!updateBaseline && !baseline) {
+    std::fprintf(stderr,
+                 "Missing or invalid baseline %s, run with --update-baseline to record one\n",
+                 baselinePath.c_str());
+    return 2;
+  }
+
+  const PerfResults results = runCorpus(iterations, quick);
+  if (!outputPath.empty() && !writeResults(outputPath, results)) {
+    std::fprintf(stderr, "Failed to write %s\n", outputPath.c_str());
+    return 2;
+  }
+
+  if (updateBaseline) {
+    if (!writeResults(baselinePath, results)) {
+      std::fprintf(stderr, "Failed to write baseline %s\n", baselinePath.c_str());
+      return 2;
+    }
+
+    std::printf("Recorded baseline %s\n", baselinePath.c_str());
+    return 0;
+  }
+
+  if (!compareResults(*baseline, results, tolerance)) {
+    std::printf("Performance regressed by more than %.0f%% against %s\n", tolerance * 100.0,
+                baselinePath.c_str());
+    return 1;
+  }
+
+  std::printf("No regressions against %s\n", baselinePath.c_str());
+  return 0;
+}
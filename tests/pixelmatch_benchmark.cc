@@ -0,0 +1,184 @@
+/**
+ * Benchmark for pixelmatch traversal orders, comparing row-major traversal against tiled traversal
+ * on wide images. Reports the best time of several iterations, and on Linux the average L1 data
+ * cache and last-level cache misses per comparison, from the hardware performance counters.
+ *
+ * Usage: pixelmatch_benchmark [width] [height] [iterations]
+ *
+ * The miss counts are shown as "-" where the counters are not available, such as in containers
+ * without access to perf events (see /proc/sys/kernel/perf_event_paranoid).
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "pixelmatch/pixelmatch.h"
+#include "synthetic_images.h"
+
+namespace pixelmatch {
+namespace {
+
+/// Hardware event counter of the calling thread, which counts nothing if it is not available.
+class CacheMissCounter {
+public:
+  enum class Event {
+    kL1DataReadMisses,
+    kLastLevelMisses,
+  };
+
+  explicit CacheMissCounter(Event event) {
+#ifdef __linux__
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    if (event == Event::kL1DataReadMisses) {
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    } else {
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    }
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+    (void)event;
+#endif
+  }
+
+  ~CacheMissCounter() {
+#ifdef __linux__
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+#endif
+  }
+
+  CacheMissCounter(const CacheMissCounter&) = delete;
+  CacheMissCounter& operator=(const CacheMissCounter&) = delete;
+
+  bool available() const { return fd_ >= 0; }
+
+  void start() {
+#ifdef __linux__
+    if (fd_ >= 0) {
+      ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  /// Stops counting, and returns the number of events since \ref start.
+  uint64_t stop() {
+    uint64_t count = 0;
+#ifdef __linux__
+    if (fd_ >= 0) {
+      ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fd_, &count, sizeof(count)) != sizeof(count)) {
+        count = 0;
+      }
+    }
+#endif
+    return count;
+  }
+
+private:
+  int fd_ = -1;
+};
+
+struct BenchmarkResult {
+  double bestMs = 0.0;
+  double l1Misses = 0.0;    //!< Average per comparison, or negative if not available.
+  double llcMisses = 0.0;   //!< Average per comparison, or negative if not available.
+  int diff = 0;
+};
+
+BenchmarkResult benchmark(const SyntheticImagePair& images, std::vector<uint8_t>& output,
+                          const Options& options, int iterations) {
+  CacheMissCounter l1Counter(CacheMissCounter::Event::kL1DataReadMisses);
+  CacheMissCounter llcCounter(CacheMissCounter::Event::kLastLevelMisses);
+
+  BenchmarkResult result;
+  uint64_t l1Misses = 0;
+  uint64_t llcMisses = 0;
+  for (int i = 0; i < iterations; ++i) {
+    l1Counter.start();
+    llcCounter.start();
+    const auto start = std::chrono::steady_clock::now();
+    result.diff = pixelmatch(images.img1, images.img2, output, images.width, images.height,
+                             images.strideInPixels, options);
+    const auto end = std::chrono::steady_clock::now();
+    llcMisses += llcCounter.stop();
+    l1Misses += l1Counter.stop();
+
+    const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    result.bestMs = i == 0 ? ms : std::min(result.bestMs, ms);
+  }
+
+  result.l1Misses = l1Counter.available() ? static_cast<double>(l1Misses) / iterations : -1.0;
+  result.llcMisses = llcCounter.available() ? static_cast<double>(llcMisses) / iterations : -1.0;
+  return result;
+}
+
+/// Print a miss count in millions, or "-" if it is not available.
+void printMisses(double misses) {
+  if (misses < 0.0) {
+    std::printf(" %10s", "-");
+  } else {
+    std::printf(" %10.2f", misses / 1e6);
+  }
+}
+
+}  // namespace
+}  // namespace pixelmatch
+
+int main(int argc, char** argv) {
+  using namespace pixelmatch;
+
+  const int width = argc > 1 ? std::atoi(argv[1]) : 7680;
+  const int height = argc > 2 ? std::atoi(argv[2]) : 1080;
+  const int iterations = argc > 3 ? std::atoi(argv[3]) : 5;
+  if (width <= 0 || height <= 0 || iterations <= 0) {
+    std::fprintf(stderr, "Usage: %s [width] [height] [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  std::printf("%-12s %8s %10s %10s %10s %10s %8s\n", "diff", "tile", "ms", "Mpx/s", "L1 M-miss",
+              "LLC M-miss", "count");
+
+  for (SyntheticDiff kind :
+       {SyntheticDiff::kSparse, SyntheticDiff::kDense, SyntheticDiff::kAntialiased}) {
+    const SyntheticImagePair images =
+        generateSyntheticImagePair(width, height, width, kind, /*seed=*/1);
+    std::vector<uint8_t> output(images.img1.size());
+
+    // Tile size 0 is the row-major traversal.
+    for (int tileSize : {0, 32, 64, 128}) {
+      Options options;
+      options.tileSize = tileSize;
+
+      const BenchmarkResult result = benchmark(images, output, options, iterations);
+      const double megapixelsPerSecond =
+          static_cast<double>(width) * height / (result.bestMs * 1000.0);
+      std::printf("%-12s %8d %10.2f %10.1f", syntheticDiffName(kind), tileSize, result.bestMs,
+                  megapixelsPerSecond);
+      printMisses(result.l1Misses);
+      printMisses(result.llcMisses);
+      std::printf(" %8d\n", result.diff);
+    }
+  }
+
+  return 0;
+}
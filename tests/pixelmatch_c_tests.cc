@@ -0,0 +1,154 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <dlfcn.h>
+#include <elf.h>
+#include <link.h>
+#endif
+
+#include "pixelmatch/image_utils.h"
+#include "pixelmatch/pixelmatch.h"
+#include "pixelmatch/pixelmatch_c.h"
+
+namespace pixelmatch {
+
+TEST(PixelmatchC, OptionsInitMatchesDefaults) {
+  pixelmatch_options options;
+  pixelmatch_options_init(&options);
+
+  const Options defaults;
+  EXPECT_EQ(options.struct_size, sizeof(pixelmatch_options));
+  EXPECT_EQ(options.threshold, defaults.threshold);
+  EXPECT_EQ(options.include_aa != 0, defaults.includeAA);
+  EXPECT_EQ(options.alpha, defaults.alpha);
+  EXPECT_EQ(options.aa_color.g, defaults.aaColor.g);
+  EXPECT_EQ(options.diff_color.r, defaults.diffColor.r);
+  EXPECT_EQ(options.has_diff_color_alt, 0);
+  EXPECT_EQ(options.diff_mask != 0, defaults.diffMask);
+  EXPECT_EQ(options.tile_size, defaults.tileSize);
+}
+
+TEST(PixelmatchC, MatchesCppApi) {
+  auto maybeImg1 = readRgbaImageFromPngFile("tests/testdata/7a.png");
+  auto maybeImg2 = readRgbaImageFromPngFile("tests/testdata/7b.png");
+  ASSERT_TRUE(maybeImg1.has_value());
+  ASSERT_TRUE(maybeImg2.has_value());
+  const Image& img1 = maybeImg1.value();
+  const Image& img2 = maybeImg2.value();
+
+  Options cppOptions;
+  cppOptions.diffColorAlt = Color{0, 255, 0, 255};
+  std::vector<uint8_t> expectedOutput(img1.data.size());
+  const int expected = pixelmatch(img1.data, img2.data, expectedOutput, img1.width, img1.height,
+                                  img1.strideInPixels, cppOptions);
+
+  pixelmatch_options options;
+  pixelmatch_options_init(&options);
+  options.has_diff_color_alt = 1;
+  options.diff_color_alt = pixelmatch_color{0, 255, 0, 255};
+
+  std::vector<uint8_t> output(img1.data.size());
+  EXPECT_EQ(pixelmatch_compare(img1.data.data(), img2.data.data(), output.data(),
+                               img1.data.size(), img1.width, img1.height, img1.strideInPixels,
+                               &options),
+            expected);
+  EXPECT_TRUE(output == expectedOutput);
+
+  // Without an output buffer or options.
+  EXPECT_EQ(pixelmatch_compare(img1.data.data(), img2.data.data(), nullptr, img1.data.size(),
+                               img1.width, img1.height, img1.strideInPixels, nullptr),
+            pixelmatch(img1.data, img2.data, span<uint8_t>(), img1.width, img1.height,
+                       img1.strideInPixels));
+}
+
+TEST(PixelmatchC, OlderStructSizeUsesDefaults) {
+  std::array<uint8_t, 4> img1{0, 0, 0, 255};
+  std::array<uint8_t, 4> img2{10, 0, 0, 255};
+
+  pixelmatch_options options;
+  pixelmatch_options_init(&options);
+  options.threshold = 0.0f;
+  EXPECT_EQ(pixelmatch_compare(img1.data(), img2.data(), nullptr, img1.size(), 1, 1, 1, &options),
+            1);
+
+  // If the struct is too small to contain the threshold, the default threshold is used, which
+  // ignores the small difference.
+  options.struct_size = offsetof(pixelmatch_options, threshold);
+  EXPECT_EQ(pixelmatch_compare(img1.data(), img2.data(), nullptr, img1.size(), 1, 1, 1, &options),
+            0);
+}
+
+#if defined(__linux__)
+/// Returns the names of the symbols defined and exported by the ELF shared library at \ref path.
+std::vector<std::string> exportedSymbols(const char* path) {
+  std::ifstream file(path, std::ios::binary);
+  const std::vector<char> data((std::istreambuf_iterator<char>(file)),
+                               std::istreambuf_iterator<char>());
+  if (data.size() < sizeof(ElfW(Ehdr))) {
+    return {};
+  }
+
+  ElfW(Ehdr) header;
+  std::memcpy(&header, data.data(), sizeof(header));
+  const auto section = [&](size_t index) {
+    ElfW(Shdr) sectionHeader;
+    std::memcpy(&sectionHeader, &data[header.e_shoff + index * header.e_shentsize],
+                sizeof(sectionHeader));
+    return sectionHeader;
+  };
+
+  std::vector<std::string> symbols;
+  for (size_t i = 0; i < header.e_shnum; ++i) {
+    const ElfW(Shdr) dynsym = section(i);
+    if (dynsym.sh_type != SHT_DYNSYM) {
+      continue;
+    }
+
+    const ElfW(Shdr) strtab = section(dynsym.sh_link);
+    for (size_t offset = 0; offset + sizeof(ElfW(Sym)) <= dynsym.sh_size;
+         offset += sizeof(ElfW(Sym))) {
+      ElfW(Sym) symbol;
+      std::memcpy(&symbol, &data[dynsym.sh_offset + offset], sizeof(symbol));
+      const unsigned char binding = ELF64_ST_BIND(symbol.st_info);
+      if (symbol.st_shndx != SHN_UNDEF && (binding == STB_GLOBAL || binding == STB_WEAK)) {
+        symbols.emplace_back(&data[strtab.sh_offset + symbol.st_name]);
+      }
+    }
+  }
+
+  return symbols;
+}
+
+TEST(PixelmatchC, SharedLibraryExportsOnlyCApi) {
+  Dl_info info;
+  ASSERT_NE(dladdr(reinterpret_cast<void*>(&pixelmatch_compare), &info), 0);
+  if (std::string(info.dli_fname).find("libpixelmatch_c") == std::string::npos) {
+    GTEST_SKIP() << "The C API is linked statically into " << info.dli_fname;
+  }
+
+  const std::vector<std::string> symbols = exportedSymbols(info.dli_fname);
+  EXPECT_THAT(symbols, testing::Contains("pixelmatch_compare"));
+  EXPECT_THAT(symbols, testing::Contains("pixelmatch_options_init"));
+  EXPECT_THAT(symbols, testing::Each(testing::StartsWith("pixelmatch_")));
+}
+#endif
+
+TEST(PixelmatchC, InvalidArguments) {
+  std::array<uint8_t, 8> img{};
+  EXPECT_EQ(pixelmatch_compare(nullptr, img.data(), nullptr, img.size(), 2, 1, 2, nullptr), -1);
+
+#ifdef NDEBUG
+  EXPECT_EQ(pixelmatch_compare(img.data(), img.data(), nullptr, img.size(), 3, 1, 3, nullptr), -1);
+#endif
+}
+
+}  // namespace pixelmatch
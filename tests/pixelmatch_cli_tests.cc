@@ -0,0 +1,143 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <sys/wait.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace pixelmatch {
+namespace {
+
+namespace fs = std::filesystem;
+
+/// Directory with a fresh copy of test images, removed at the end of the test.
+class CliTest : public testing::Test {
+protected:
+  void SetUp() override {
+    const char* cli = std::getenv("PIXELMATCH_CLI");
+    ASSERT_NE(cli, nullptr) << "PIXELMATCH_CLI must be set to the path of pixelmatch_cli";
+    cli_ = fs::absolute(cli).string();
+
+    root_ = fs::path(testing::TempDir()) /
+            testing::UnitTest::GetInstance()->current_test_info()->name();
+    fs::remove_all(root_);
+    fs::create_directories(root_);
+  }
+
+  void TearDown() override { fs::remove_all(root_); }
+
+  /// Copy a file of tests/testdata to \ref path, relative to the test directory.
+  void copyTestImage(const std::string& filename, const fs::path& path) {
+    fs::create_directories((root_ / path).parent_path());
+    fs::copy_file(fs::path("tests/testdata") / filename, root_ / path);
+  }
+
+  /// Run pixelmatch_cli with \ref args, from the test directory, and return its exit code.
+  int runCli(const std::vector<std::string>& args) {
+    std::string command = "cd '" + root_.string() + "' && '" + cli_ + "'";
+    for (const std::string& arg : args) {
+      command += " '" + arg + "'";
+    }
+    command += " > stdout.txt 2> stderr.txt";
+
+    const int status = std::system(command.c_str());
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  }
+
+  std::string readFile(const fs::path& path) {
+    std::ifstream file(root_ / path);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+
+  std::string cli_;
+  fs::path root_;
+};
+
+TEST_F(CliTest, SinglePairExitCodes) {
+  copyTestImage("1a.png", "a.png");
+  copyTestImage("1b.png", "b.png");
+
+  EXPECT_EQ(runCli({"a.png", "a.png"}), 0);
+  EXPECT_EQ(readFile("stdout.txt"), "different pixels: 0\n");
+
+  EXPECT_EQ(runCli({"--threshold=0.05", "a.png", "b.png", "diff.png"}), 1);
+  EXPECT_EQ(readFile("stdout.txt"), "different pixels: 143\n");
+  EXPECT_TRUE(fs::exists(root_ / "diff.png"));
+
+  // Differences within --max-diff pass.
+  EXPECT_EQ(runCli({"--threshold=0.05", "--max-diff=143", "a.png", "b.png"}), 0);
+
+  EXPECT_EQ(runCli({"a.png", "missing.png"}), 1);
+  EXPECT_THAT(readFile("stderr.txt"), testing::HasSubstr("missing missing.png"));
+}
+
+TEST_F(CliTest, RejectsInvalidFlags) {
+  copyTestImage("1a.png", "a.png");
+
+  for (const std::string flag :
+       {"--threshold=abc", "--threshold=0.1x", "--threshold=2", "--alpha=-1", "--max-diff=-1",
+        "--max-diff=1.5", "-j0", "-jx", "--metric=lab", "--unknown"}) {
+    SCOPED_TRACE(flag);
+    EXPECT_EQ(runCli({flag, "a.png", "a.png"}), 2);
+    EXPECT_THAT(readFile("stderr.txt"), testing::HasSubstr("Usage:"));
+  }
+
+  EXPECT_EQ(runCli({"-j", "2", "a.png", "a.png"}), 0);
+  EXPECT_EQ(runCli({"a.png"}), 2);
+}
+
+TEST_F(CliTest, DirectoryModePairsByRelativePath) {
+  copyTestImage("1a.png", "golden/same.png");
+  copyTestImage("1a.png", "actual/same.png");
+  copyTestImage("2a.png", "golden/nested/changed.png");
+  copyTestImage("2b.png", "actual/nested/changed.png");
+  copyTestImage("3a.png", "golden/only_golden.png");
+  copyTestImage("3a.png", "actual/only_actual.png");
+
+  EXPECT_EQ(runCli({"-j", "2", "--diff-dir=diffs", "--json=summary.json", "golden", "actual"}),
+            1);
+
+  // Diffs are only written for the failing pairs.
+  EXPECT_TRUE(fs::exists(root_ / "diffs/nested/changed.png"));
+  EXPECT_FALSE(fs::exists(root_ / "diffs/same.png"));
+
+  const std::string summary = readFile("summary.json");
+  EXPECT_THAT(summary, testing::HasSubstr("\"total\": 4,"));
+  EXPECT_THAT(summary, testing::HasSubstr("\"matched\": 1,"));
+  EXPECT_THAT(summary, testing::HasSubstr("\"different\": 1,"));
+  EXPECT_THAT(summary, testing::HasSubstr("\"missing\": 2,"));
+  EXPECT_THAT(summary, testing::HasSubstr("\"errors\": 0,"));
+  EXPECT_THAT(summary, testing::HasSubstr("{\"name\": \"nested/changed.png\", \"status\": "
+                                          "\"different\""));
+  EXPECT_THAT(summary, testing::HasSubstr("{\"name\": \"only_actual.png\", \"status\": "
+                                          "\"missing\""));
+  EXPECT_THAT(summary, testing::HasSubstr("{\"name\": \"same.png\", \"status\": \"match\""));
+
+  // Once every pair matches, the exit code is 0. The summary can also go to stdout.
+  fs::remove(root_ / "actual/nested/changed.png");
+  copyTestImage("2a.png", "actual/nested/changed.png");
+  fs::remove(root_ / "actual/only_actual.png");
+  fs::remove(root_ / "golden/only_golden.png");
+  EXPECT_EQ(runCli({"--json=-", "golden", "actual"}), 0);
+  EXPECT_THAT(readFile("stdout.txt"), testing::HasSubstr("\"matched\": 2,"));
+
+  EXPECT_EQ(runCli({"golden", "actual"}), 0);
+  EXPECT_EQ(readFile("stdout.txt"), "2/2 images match\n");
+}
+
+TEST_F(CliTest, UnreadablePairIsAnError) {
+  copyTestImage("1a.png", "golden/image.png");
+  fs::create_directories(root_ / "actual");
+  std::ofstream(root_ / "actual/image.png") << "not a png";
+
+  EXPECT_EQ(runCli({"--json=summary.json", "golden", "actual"}), 1);
+  EXPECT_THAT(readFile("summary.json"), testing::HasSubstr("\"errors\": 1,"));
+  EXPECT_THAT(readFile("stderr.txt"), testing::HasSubstr("failed to load"));
+}
+
+}  // namespace
+}  // namespace pixelmatch
@@ -0,0 +1,86 @@
+#include <fuzzer/FuzzedDataProvider.h>
+#include <pixelmatch/pixelmatch.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "pixelmatch_reference.h"
+#include "pixelmatch_variants.h"
+
+namespace pixelmatch {
+namespace {
+
+Color createColor(FuzzedDataProvider& provider) {
+  return Color{provider.ConsumeIntegral<uint8_t>(), provider.ConsumeIntegral<uint8_t>(),
+               provider.ConsumeIntegral<uint8_t>(), provider.ConsumeIntegral<uint8_t>()};
+}
+
+Options createOptions(FuzzedDataProvider& provider) {
+  Options options;
+  options.threshold = provider.ConsumeFloatingPointInRange<float>(0.0f, 1.0f);
+  options.includeAA = provider.ConsumeBool();
+  options.alpha = provider.ConsumeFloatingPointInRange<float>(0.0f, 1.0f);
+  options.aaColor = createColor(provider);
+  options.diffColor = createColor(provider);
+  if (provider.ConsumeBool()) {
+    options.diffColorAlt = createColor(provider);
+  }
+  options.diffMask = provider.ConsumeBool();
+  return options;
+}
+
+/// Report a mismatch between a variant and the reference, and abort so that the fuzzer stops.
+[[noreturn]] void reportMismatch(const VariantResult& result, const char* what, int expectedDiff) {
+  std::fprintf(stderr, "Variant \"%s\" does not match the reference: %s (diff %d, expected %d)\n",
+               result.name.c_str(), what, result.diff, expectedDiff);
+  std::abort();
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv) {
+  return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t dataSize) {
+  FuzzedDataProvider provider(data, dataSize);
+
+  // Only valid inputs, so that every variant compares pixels.
+  const Options options = createOptions(provider);
+  const int width = provider.ConsumeIntegralInRange<int>(1, 100);
+  const int height = provider.ConsumeIntegralInRange<int>(1, 100);
+  const size_t strideInPixels =
+      provider.ConsumeIntegralInRange<size_t>(static_cast<size_t>(width), 128);
+  const size_t size = strideInPixels * height * 4;
+
+  // Derive img2 from img1 by overwriting a few bytes, so that the images are mostly similar and
+  // anti-aliasing detection is exercised, instead of being unrelated noise.
+  std::vector<uint8_t> img1 = provider.ConsumeBytes<uint8_t>(size);
+  img1.resize(size);
+  std::vector<uint8_t> img2 = img1;
+  const size_t edits = provider.ConsumeIntegralInRange<size_t>(0, 64);
+  for (size_t i = 0; i < edits && provider.remaining_bytes() > 0; ++i) {
+    img2[provider.ConsumeIntegralInRange<size_t>(0, size - 1)] =
+        provider.ConsumeIntegral<uint8_t>();
+  }
+
+  std::vector<uint8_t> expectedOutput(size, 0);
+  const int expectedDiff =
+      reference::pixelmatch(img1, img2, expectedOutput, width, height, strideInPixels, options);
+
+  for (const VariantResult& result :
+       runPixelmatchVariants(img1, img2, width, height, strideInPixels, options)) {
+    if (result.diff != expectedDiff) {
+      reportMismatch(result, "different pixel count", expectedDiff);
+    }
+
+    if (result.hasOutput && result.output != expectedOutput) {
+      reportMismatch(result, "different output", expectedDiff);
+    }
+  }
+
+  return 0;
+}
+
+}  // namespace pixelmatch
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <pixelmatch/pixelmatch.h>
+
+namespace pixelmatch {
+namespace reference {
+
+/**
+ * Reference implementation of \ref pixelmatch::pixelmatch: the original scalar, single-threaded,
+ * row-by-row comparison of 8-bit images with the YIQ metric.
+ *
+ * Optimized variants of the library must produce the same count and output bytes, see
+ * differential_tests.cc and pixelmatch_differential_fuzzer.cc. Only the options that existed in
+ * the original implementation are used: threshold, includeAA, alpha, aaColor, diffColor,
+ * diffColorAlt and diffMask.
+ *
+ * @return The number of different pixels, or -1 if a precondition fails.
+ */
+int pixelmatch(span<const uint8_t> img1, span<const uint8_t> img2, span<uint8_t> output, int width,
+               int height, size_t strideInPixels, const Options& options) noexcept;
+
+}  // namespace reference
+}  // namespace pixelmatch
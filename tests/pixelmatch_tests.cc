@@ -3,10 +3,13 @@
 #include <gtest/gtest.h>
 
 #include <array>
+#include <cstring>
 #include <filesystem>
 
+#include "pixelmatch/executor.h"
 #include "pixelmatch/image_utils.h"
 #include "pixelmatch/pixelmatch.h"
+#include "synthetic_images.h"
 
 namespace pixelmatch {
 
@@ -28,7 +31,9 @@ std::ostream& operator<<(std::ostream& os, const Options& options) {
   return os << "Options{threshold=" << options.threshold << ", includeAA=" << options.includeAA
             << ", alpha=" << options.alpha << ", aaColor=" << options.aaColor
             << ", diffColor=" << options.diffColor << ", diffColorAlt=" << options.diffColorAlt
-            << ", diffMask=" << options.diffMask << "}";
+            << ", diffMask=" << options.diffMask << ", tileSize=" << options.tileSize
+            << ", heatmap=" << options.heatmap
+            << ", colorMetric=" << static_cast<int>(options.colorMetric) << "}";
 }
 
 std::string escapeFilename(std::string filename) {
@@ -142,12 +147,24 @@ bool compareSinglePixel(const Color& pixel1, const Color& pixel2) {
   return difference == 0;
 }
 
+Image loadTestImage(const char* filename) {
+  auto maybeImg = readRgbaImageFromPngFile(filename);
+  EXPECT_TRUE(maybeImg.has_value()) << "Failed to load " << filename;
+  return maybeImg.value_or(Image{});
+}
+
 Options defaultTestOptions() {
   Options result;
   result.threshold = 0.05f;
   return result;
 }
 
+Options metricTestOptions(ColorMetric metric) {
+  Options options = defaultTestOptions();
+  options.colorMetric = metric;
+  return options;
+}
+
 TEST(Pixelmatch, Validate1Diff) {
   diffTest("tests/testdata/1a.png", "tests/testdata/1b.png", "tests/testdata/1diff.png",
            defaultTestOptions(), 143);
@@ -263,6 +280,629 @@ TEST(Pixelmatch, WithStride) {
   }
 }
 
+TEST(Pixelmatch, TileSizeDoesNotChangeResult) {
+  // Use a width and height that are not a multiple of the tile sizes, to cover partial tiles.
+  const SyntheticImagePair images = generateSyntheticImagePair(
+      300, 170, 310, SyntheticDiff::kAntialiased, /*seed=*/42, /*alpha=*/true);
+
+  std::vector<uint8_t> expectedOutput(images.img1.size());
+  const int expectedDiff = pixelmatch(images.img1, images.img2, expectedOutput, images.width,
+                                      images.height, images.strideInPixels);
+  EXPECT_GT(expectedDiff, 0);
+
+  SparseDiff expectedSparse;
+  ASSERT_EQ(pixelmatchSparse(images.img1, images.img2, images.width, images.height,
+                             images.strideInPixels, expectedSparse),
+            expectedDiff);
+
+  for (int tileSize : {1, 2, 7, 64, 1000}) {
+    SCOPED_TRACE(testing::Message() << "tileSize=" << tileSize);
+
+    Options options;
+    options.tileSize = tileSize;
+
+    std::vector<uint8_t> output(images.img1.size());
+    EXPECT_EQ(pixelmatch(images.img1, images.img2, output, images.width, images.height,
+                         images.strideInPixels, options),
+              expectedDiff);
+    EXPECT_TRUE(output == expectedOutput);
+
+    // Runs of different tiles are joined back into the runs of the rows.
+    SparseDiff sparse;
+    EXPECT_EQ(pixelmatchSparse(images.img1, images.img2, images.width, images.height,
+                               images.strideInPixels, sparse, options),
+              expectedDiff);
+    ASSERT_EQ(sparse.runs.size(), expectedSparse.runs.size());
+    for (size_t i = 0; i < sparse.runs.size(); ++i) {
+      EXPECT_EQ(sparse.runs[i].x, expectedSparse.runs[i].x) << "run " << i;
+      EXPECT_EQ(sparse.runs[i].y, expectedSparse.runs[i].y) << "run " << i;
+      EXPECT_EQ(sparse.runs[i].length, expectedSparse.runs[i].length) << "run " << i;
+      EXPECT_EQ(sparse.runs[i].kind, expectedSparse.runs[i].kind) << "run " << i;
+    }
+  }
+}
+
+TEST(Pixelmatch, HighBitDepthMatches8Bit) {
+  const struct {
+    const char* filename1;
+    const char* filename2;
+    Options options;
+  } kCases[] = {
+      {"tests/testdata/1a.png", "tests/testdata/1b.png", defaultTestOptions()},
+      {"tests/testdata/3a.png", "tests/testdata/3b.png", defaultTestOptions()},
+      {"tests/testdata/6a.png", "tests/testdata/6b.png", defaultTestOptions()},
+      {"tests/testdata/1a.png", "tests/testdata/1b.png", metricTestOptions(ColorMetric::kOklab)},
+      {"tests/testdata/1a.png", "tests/testdata/1b.png",
+       metricTestOptions(ColorMetric::kCiede2000)},
+  };
+
+  for (const auto& testCase : kCases) {
+    SCOPED_TRACE(testing::Message() << testCase.filename1 << " vs " << testCase.filename2);
+
+    const Image img1 = loadTestImage(testCase.filename1);
+    const Image img2 = loadTestImage(testCase.filename2);
+    const int expected = pixelmatch(img1.data, img2.data, span<uint8_t>(), img1.width,
+                                    img1.height, img1.strideInPixels, testCase.options);
+
+    auto maybeImg1_16 = readRgba16ImageFromPngFile(testCase.filename1);
+    auto maybeImg2_16 = readRgba16ImageFromPngFile(testCase.filename2);
+    ASSERT_TRUE(maybeImg1_16.has_value());
+    ASSERT_TRUE(maybeImg2_16.has_value());
+
+    std::vector<uint16_t> output16(maybeImg1_16->data.size());
+    EXPECT_EQ(pixelmatch(maybeImg1_16->data, maybeImg2_16->data, output16, img1.width,
+                         img1.height, img1.strideInPixels, testCase.options),
+              expected);
+
+    std::vector<float> img1Float(img1.data.begin(), img1.data.end());
+    std::vector<float> img2Float(img2.data.begin(), img2.data.end());
+    for (float& value : img1Float) {
+      value /= 255.0f;
+    }
+    for (float& value : img2Float) {
+      value /= 255.0f;
+    }
+
+    std::vector<float> outputFloat(img1Float.size());
+    EXPECT_EQ(pixelmatch(img1Float, img2Float, outputFloat, img1.width, img1.height,
+                         img1.strideInPixels, testCase.options),
+              expected);
+  }
+}
+
+TEST(Pixelmatch, HighBitDepthDetectsSmallDifferences) {
+  // A difference that is lost when quantizing to 8 bits.
+  const std::array<uint16_t, 4> img1{1000, 1000, 1000, 65535};
+  const std::array<uint16_t, 4> img2{1100, 1000, 1000, 65535};
+
+  Options options;
+  options.threshold = 0.0f;
+  EXPECT_EQ(pixelmatch(img1, img2, span<uint16_t>(), 1, 1, 1, options), 1);
+  EXPECT_EQ(pixelmatch(img1, img1, span<uint16_t>(), 1, 1, 1, options), 0);
+
+  const std::array<float, 4> imgFloat1{0.5f, 0.5f, 0.5f, 1.0f};
+  const std::array<float, 4> imgFloat2{0.5001f, 0.5f, 0.5f, 1.0f};
+  EXPECT_EQ(pixelmatch(imgFloat1, imgFloat2, span<float>(), 1, 1, 1, options), 1);
+}
+
+/// Shift an image by (dx, dy), filling uncovered pixels with white.
+std::vector<uint8_t> shiftImage(const std::vector<uint8_t>& img, int width, int height,
+                                size_t strideInPixels, int dx, int dy) {
+  std::vector<uint8_t> result(img.size(), 255);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const int srcX = x - dx;
+      const int srcY = y - dy;
+      if (srcX >= 0 && srcX < width && srcY >= 0 && srcY < height) {
+        std::memcpy(&result[(y * strideInPixels + x) * 4],
+                    &img[(srcY * strideInPixels + srcX) * 4], 4);
+      }
+    }
+  }
+
+  return result;
+}
+
+TEST(Pixelmatch, EstimateTranslation) {
+  const Image img = loadTestImage("tests/testdata/4a.png");
+
+  for (const Translation shift : {Translation{0, 0}, Translation{3, 0}, Translation{0, -2},
+                                  Translation{-1, 4}}) {
+    SCOPED_TRACE(testing::Message() << "dx=" << shift.dx << ", dy=" << shift.dy);
+
+    const std::vector<uint8_t> shifted =
+        shiftImage(img.data, img.width, img.height, img.strideInPixels, shift.dx, shift.dy);
+    const std::optional<Translation> estimate =
+        estimateTranslation(img.data, shifted, img.width, img.height, img.strideInPixels, 8);
+    ASSERT_TRUE(estimate.has_value());
+    EXPECT_EQ(estimate->dx, shift.dx);
+    EXPECT_EQ(estimate->dy, shift.dy);
+  }
+}
+
+TEST(Pixelmatch, AlignedCompensatesForShift) {
+  const Image img = loadTestImage("tests/testdata/4a.png");
+  const std::vector<uint8_t> shifted =
+      shiftImage(img.data, img.width, img.height, img.strideInPixels, 2, -1);
+
+  const int unaligned = pixelmatch(img.data, shifted, span<uint8_t>(), img.width, img.height,
+                                   img.strideInPixels, defaultTestOptions());
+
+  std::vector<uint8_t> output(img.data.size());
+  const std::optional<AlignedResult> aligned =
+      pixelmatchAligned(img.data, shifted, output, img.width, img.height, img.strideInPixels,
+                        /*maxShift=*/4, defaultTestOptions());
+  ASSERT_TRUE(aligned.has_value());
+  EXPECT_EQ(aligned->translation.dx, 2);
+  EXPECT_EQ(aligned->translation.dy, -1);
+
+  // Only the strips uncovered by the shift remain different.
+  const int uncovered = 2 * img.height + 1 * img.width - 2 * 1;
+  EXPECT_EQ(aligned->diff, uncovered);
+  EXPECT_GT(unaligned, aligned->diff);
+
+  // Pixels in the overlapping region are drawn as similar (gray), and the uncovered pixels in the
+  // right columns as different.
+  const size_t overlapPos = (5 * img.strideInPixels + 0) * 4;
+  EXPECT_EQ(output[overlapPos + 0], output[overlapPos + 1]);
+  const size_t uncoveredPos = (5 * img.strideInPixels + img.width - 1) * 4;
+  EXPECT_EQ(output[uncoveredPos + 0], 255);
+  EXPECT_EQ(output[uncoveredPos + 1], 0);
+
+  // With a diff mask, the kept shift draws only the uncovered pixels over the existing output.
+  Options maskOptions = defaultTestOptions();
+  maskOptions.diffMask = true;
+  std::vector<uint8_t> maskOutput(img.data.size(), 7);
+  const std::optional<AlignedResult> masked =
+      pixelmatchAligned(img.data, shifted, maskOutput, img.width, img.height,
+                        img.strideInPixels, /*maxShift=*/4, maskOptions);
+  ASSERT_TRUE(masked.has_value());
+  EXPECT_EQ(masked->diff, uncovered);
+  EXPECT_EQ(maskOutput[overlapPos + 0], 7);
+  EXPECT_EQ(maskOutput[uncoveredPos + 0], 255);
+  EXPECT_EQ(maskOutput[uncoveredPos + 1], 0);
+}
+
+TEST(Pixelmatch, AlignedWithoutShiftMatchesPixelmatch) {
+  const Image img1 = loadTestImage("tests/testdata/1a.png");
+  const Image img2 = loadTestImage("tests/testdata/1b.png");
+
+  const std::optional<AlignedResult> aligned =
+      pixelmatchAligned(img1.data, img2.data, span<uint8_t>(), img1.width, img1.height,
+                        img1.strideInPixels, /*maxShift=*/4, defaultTestOptions());
+  ASSERT_TRUE(aligned.has_value());
+  EXPECT_EQ(aligned->translation.dx, 0);
+  EXPECT_EQ(aligned->translation.dy, 0);
+  EXPECT_EQ(aligned->diff, 143);
+}
+
+TEST(Pixelmatch, AlignedRejectsSpuriousShift) {
+  // A uniform page where a small square moved by one pixel. The column profiles suggest a shift of
+  // the whole page, but shifting would turn a full border column into differences.
+  constexpr int kWidth = 64;
+  constexpr int kHeight = 64;
+  std::vector<uint8_t> img1(kWidth * kHeight * 4, 255);
+  std::vector<uint8_t> img2 = img1;
+  const auto drawSquare = [](std::vector<uint8_t>& img, int left) {
+    for (int y = 20; y < 26; ++y) {
+      for (int x = left; x < left + 6; ++x) {
+        std::fill_n(&img[(y * kWidth + x) * 4], 3, uint8_t(0));
+      }
+    }
+  };
+  drawSquare(img1, 20);
+  drawSquare(img2, 21);
+
+  const std::optional<Translation> estimate =
+      estimateTranslation(img1, img2, kWidth, kHeight, kWidth, /*maxShift=*/4);
+  ASSERT_TRUE(estimate.has_value());
+  ASSERT_EQ(estimate->dx, 1);
+
+  for (const bool diffMask : {false, true}) {
+    SCOPED_TRACE(testing::Message() << "diffMask=" << diffMask);
+    Options options = defaultTestOptions();
+    options.diffMask = diffMask;
+
+    // Start from a non-zero output, which a diff mask leaves in place for matching pixels.
+    std::vector<uint8_t> expectedOutput(img1.size(), 7);
+    const int expectedDiff =
+        pixelmatch(img1, img2, expectedOutput, kWidth, kHeight, kWidth, options);
+
+    std::vector<uint8_t> output(img1.size(), 7);
+    const std::optional<AlignedResult> aligned =
+        pixelmatchAligned(img1, img2, output, kWidth, kHeight, kWidth, /*maxShift=*/4, options);
+    ASSERT_TRUE(aligned.has_value());
+    EXPECT_EQ(aligned->translation.dx, 0);
+    EXPECT_EQ(aligned->translation.dy, 0);
+    EXPECT_EQ(aligned->diff, expectedDiff);
+    EXPECT_LT(aligned->diff, kHeight);
+    EXPECT_EQ(output, expectedOutput);
+  }
+}
+
+/// Copy a region of an image into a new buffer with the given stride.
+std::vector<uint8_t> cropImage(const Image& img, int x, int y, int width, int height,
+                               size_t strideInPixels) {
+  std::vector<uint8_t> result(strideInPixels * height * 4);
+  for (int row = 0; row < height; ++row) {
+    std::memcpy(&result[row * strideInPixels * 4],
+                &img.data[((y + row) * img.strideInPixels + x) * 4], width * 4);
+  }
+
+  return result;
+}
+
+TEST(Pixelmatch, FindSubImage) {
+  const Image img = loadTestImage("tests/testdata/4a.png");
+
+  for (const auto& [x, y, width, height] :
+       std::vector<std::array<int, 4>>{{37, 21, 64, 48}, {300, 250, 120, 150}, {0, 0, 5, 3}}) {
+    SCOPED_TRACE(testing::Message() << "x=" << x << ", y=" << y);
+
+    const size_t subStride = width + 3;
+    const std::vector<uint8_t> subImg = cropImage(img, x, y, width, height, subStride);
+
+    const std::optional<SubImageMatch> match =
+        findSubImage(img.data, img.width, img.height, img.strideInPixels, subImg, width, height,
+                     subStride, span<uint8_t>(), defaultTestOptions());
+    ASSERT_TRUE(match.has_value());
+    EXPECT_EQ(match->x, x);
+    EXPECT_EQ(match->y, y);
+    EXPECT_EQ(match->diff, 0);
+  }
+}
+
+TEST(Pixelmatch, FindSubImageMatchesPixelmatchOnCrop) {
+  const Image img1 = loadTestImage("tests/testdata/1a.png");
+  const Image img2 = loadTestImage("tests/testdata/1b.png");
+
+  const int x = 120;
+  const int y = 40;
+  const int width = 200;
+  const int height = 160;
+  const std::vector<uint8_t> crop1 = cropImage(img1, x, y, width, height, width);
+  const std::vector<uint8_t> crop2 = cropImage(img2, x, y, width, height, width);
+
+  std::vector<uint8_t> expectedOutput(crop1.size());
+  const int expectedDiff =
+      pixelmatch(crop1, crop2, expectedOutput, width, height, width, defaultTestOptions());
+  ASSERT_GT(expectedDiff, 0);
+
+  std::vector<uint8_t> output(crop2.size());
+  const std::optional<SubImageMatch> match =
+      findSubImage(img1.data, img1.width, img1.height, img1.strideInPixels, crop2, width, height,
+                   width, output, defaultTestOptions());
+  ASSERT_TRUE(match.has_value());
+  EXPECT_EQ(match->x, x);
+  EXPECT_EQ(match->y, y);
+  EXPECT_EQ(match->diff, expectedDiff);
+  EXPECT_EQ(output, expectedOutput);
+}
+
+TEST(Pixelmatch, DeltaPlaneRethresholds) {
+  const Image img1 = loadTestImage("tests/testdata/1a.png");
+  const Image img2 = loadTestImage("tests/testdata/1b.png");
+  const size_t planeSize = img1.strideInPixels * img1.height;
+
+  Options options = defaultTestOptions();
+  options.includeAA = true;
+
+  std::vector<float> deltas(planeSize);
+  std::vector<uint16_t> deltas16(planeSize);
+  const int diff = pixelmatchWithDeltas(img1.data, img2.data, span<uint8_t>(), deltas,
+                                        img1.width, img1.height, img1.strideInPixels, options);
+  EXPECT_EQ(diff, pixelmatch(img1.data, img2.data, span<uint8_t>(), img1.width, img1.height,
+                             img1.strideInPixels, options));
+  EXPECT_EQ(diff, pixelmatchWithDeltas(img1.data, img2.data, span<uint8_t>(), deltas16,
+                                       img1.width, img1.height, img1.strideInPixels, options));
+
+  for (size_t i = 0; i < planeSize; ++i) {
+    EXPECT_NEAR(deltas16[i] / 65535.0f, deltas[i], 1.0f / 65535.0f);
+  }
+
+  // Re-thresholding the delta plane gives the same counts as comparing again.
+  for (const float threshold : {0.0f, 0.05f, 0.1f, 0.3f}) {
+    SCOPED_TRACE(testing::Message() << "threshold=" << threshold);
+
+    options.threshold = threshold;
+    const int expected = pixelmatch(img1.data, img2.data, span<uint8_t>(), img1.width,
+                                    img1.height, img1.strideInPixels, options);
+    EXPECT_EQ(std::count_if(deltas.begin(), deltas.end(),
+                            [threshold](float delta) { return delta > threshold; }),
+              expected);
+  }
+}
+
+TEST(Pixelmatch, DeltaPlaneIdentical) {
+  const Image img = loadTestImage("tests/testdata/1a.png");
+
+  std::vector<float> deltas(img.strideInPixels * img.height, 1.0f);
+  EXPECT_EQ(pixelmatchWithDeltas(img.data, img.data, span<uint8_t>(), deltas, img.width,
+                                 img.height, img.strideInPixels),
+            0);
+  EXPECT_TRUE(std::all_of(deltas.begin(), deltas.end(), [](float delta) { return delta == 0; }));
+}
+
+TEST(Pixelmatch, Heatmap) {
+  const Image img1 = loadTestImage("tests/testdata/1a.png");
+  const Image img2 = loadTestImage("tests/testdata/1b.png");
+
+  Options options = defaultTestOptions();
+  options.diffColor = Color{0, 255, 0, 255};
+  std::vector<uint8_t> expectedOutput(img1.data.size());
+  const int expectedDiff = pixelmatch(img1.data, img2.data, expectedOutput, img1.width,
+                                      img1.height, img1.strideInPixels, options);
+
+  options.heatmap = true;
+  std::vector<uint8_t> output(img1.data.size());
+  EXPECT_EQ(pixelmatch(img1.data, img2.data, output, img1.width, img1.height,
+                       img1.strideInPixels, options),
+            expectedDiff);
+
+  // Only different pixels change color, and they are drawn with the blue to red ramp.
+  int heatmapPixels = 0;
+  for (size_t pos = 0; pos < output.size(); pos += 4) {
+    if (expectedOutput[pos + 0] == 0 && expectedOutput[pos + 1] == 255 &&
+        expectedOutput[pos + 2] == 0) {
+      ++heatmapPixels;
+      EXPECT_EQ(output[pos + 1], 0);
+      EXPECT_EQ(std::max(output[pos + 0], output[pos + 2]), 255);
+    } else {
+      EXPECT_EQ(std::memcmp(&output[pos], &expectedOutput[pos], 4), 0);
+    }
+  }
+  EXPECT_EQ(heatmapPixels, expectedDiff);
+
+  // A custom single color ramp replaces the diff color.
+  const std::array<Color, 1> ramp = {Color{0, 255, 0, 255}};
+  options.heatmapColors = ramp;
+  EXPECT_EQ(pixelmatch(img1.data, img2.data, output, img1.width, img1.height,
+                       img1.strideInPixels, options),
+            expectedDiff);
+  EXPECT_EQ(output, expectedOutput);
+}
+
+TEST(Pixelmatch, MultipleThresholds) {
+  const std::array<float, 6> thresholds = {0.0f, 0.01f, 0.05f, 0.1f, 0.3f, 0.9f};
+
+  for (const char* name : {"1", "3", "6"}) {
+    const Image img1 = loadTestImage(("tests/testdata/" + std::string(name) + "a.png").c_str());
+    const Image img2 = loadTestImage(("tests/testdata/" + std::string(name) + "b.png").c_str());
+
+    for (const ColorMetric metric :
+         {ColorMetric::kYiq, ColorMetric::kOklab, ColorMetric::kCiede2000}) {
+      for (const bool includeAA : {false, true}) {
+        SCOPED_TRACE(testing::Message() << name << ", metric=" << static_cast<int>(metric)
+                                        << ", includeAA=" << includeAA);
+
+        Options options;
+        options.colorMetric = metric;
+        options.includeAA = includeAA;
+        const std::optional<std::vector<int>> diffs =
+            pixelmatchThresholds(img1.data, img2.data, img1.width, img1.height,
+                                 img1.strideInPixels, thresholds, options);
+        ASSERT_TRUE(diffs.has_value());
+        ASSERT_EQ(diffs->size(), thresholds.size());
+
+        ThreadExecutor executor(3);
+        Options parallelOptions = options;
+        parallelOptions.executor = &executor;
+        EXPECT_EQ(pixelmatchThresholds(img1.data, img2.data, img1.width, img1.height,
+                                       img1.strideInPixels, thresholds, parallelOptions),
+                  diffs);
+
+        for (size_t i = 0; i < thresholds.size(); ++i) {
+          options.threshold = thresholds[i];
+          EXPECT_EQ((*diffs)[i], pixelmatch(img1.data, img2.data, span<uint8_t>(), img1.width,
+                                            img1.height, img1.strideInPixels, options))
+              << "threshold=" << thresholds[i];
+        }
+      }
+    }
+  }
+}
+
+TEST(Pixelmatch, ColorMetricDeltas) {
+  // Reference distances computed in double precision; the CIEDE2000 implementation used for them
+  // reproduces the test data of Sharma et al.
+  const struct {
+    Color color1;
+    Color color2;
+    float oklab;
+    float ciede2000;
+    bool darker;
+  } kPairs[] = {
+      {{255, 0, 0, 255}, {0, 255, 0, 255}, 0.51981f, 86.6082f, false},
+      {{0, 0, 0, 255}, {255, 255, 255, 255}, 1.0f, 100.0f, false},
+      {{255, 255, 255, 255}, {0, 0, 0, 255}, 1.0f, 100.0f, true},
+      {{0, 0, 255, 255}, {255, 255, 0, 255}, 0.72659f, 103.4270f, false},
+      {{128, 128, 128, 255}, {131, 128, 128, 255}, 0.00447f, 1.6877f, false},
+      {{200, 30, 120, 255}, {190, 40, 130, 255}, 0.02492f, 3.3457f, true},
+      {{255, 0, 255, 255}, {255, 0, 200, 255}, 0.08191f, 7.7029f, true},
+  };
+  constexpr int kWidth = static_cast<int>(std::size(kPairs));
+
+  std::array<uint8_t, kWidth * 4> img1;
+  std::array<uint8_t, kWidth * 4> img2;
+  for (int i = 0; i < kWidth; ++i) {
+    setPixel(img1, i, kPairs[i].color1);
+    setPixel(img2, i, kPairs[i].color2);
+  }
+
+  for (const ColorMetric metric : {ColorMetric::kOklab, ColorMetric::kCiede2000}) {
+    SCOPED_TRACE(testing::Message() << "metric=" << static_cast<int>(metric));
+
+    Options options = metricTestOptions(metric);
+    options.includeAA = true;
+    options.threshold = 0.0f;
+    options.diffColorAlt = Color{0, 255, 0, 255};
+
+    std::array<uint8_t, kWidth * 4> output;
+    std::array<float, kWidth> deltas;
+    EXPECT_EQ(pixelmatchWithDeltas(img1, img2, output, deltas, kWidth, 1, kWidth, options),
+              kWidth);
+
+    for (int i = 0; i < kWidth; ++i) {
+      const float expected =
+          metric == ColorMetric::kOklab ? kPairs[i].oklab : kPairs[i].ciede2000 / 100.0f;
+      EXPECT_NEAR(deltas[i], expected, 2e-4f) << "pair " << i;
+
+      // Pixels which get darker are drawn with the alternative color.
+      EXPECT_EQ(output[i * 4 + 1], kPairs[i].darker ? 255 : 0) << "pair " << i;
+    }
+  }
+}
+
+TEST(Pixelmatch, SparseDiff) {
+  const Image img1 = loadTestImage("tests/testdata/1a.png");
+  const Image img2 = loadTestImage("tests/testdata/1b.png");
+
+  Options options = defaultTestOptions();
+  options.diffColorAlt = Color{0, 255, 0, 255};
+  std::vector<uint8_t> expectedOutput(img1.data.size());
+  const int expectedDiff = pixelmatch(img1.data, img2.data, expectedOutput, img1.width,
+                                      img1.height, img1.strideInPixels, options);
+
+  SparseDiff sparse;
+  ASSERT_EQ(pixelmatchSparse(img1.data, img2.data, img1.width, img1.height, img1.strideInPixels,
+                             sparse, options),
+            expectedDiff);
+  EXPECT_EQ(sparse.width, img1.width);
+  EXPECT_EQ(sparse.height, img1.height);
+
+  // Runs are in order, and only the different ones count.
+  int diffPixels = 0;
+  for (size_t i = 0; i < sparse.runs.size(); ++i) {
+    const DiffRun& run = sparse.runs[i];
+    if (i > 0) {
+      const DiffRun& previous = sparse.runs[i - 1];
+      EXPECT_TRUE(previous.y < run.y || previous.x + previous.length <= run.x) << "run " << i;
+    }
+
+    if (run.kind != DiffRunKind::kAntialiased) {
+      diffPixels += run.length;
+    }
+  }
+  EXPECT_EQ(diffPixels, expectedDiff);
+
+  std::vector<uint8_t> output(img1.data.size());
+  ASSERT_TRUE(renderSparseDiff(sparse, img1.data, img1.strideInPixels, output, options));
+  EXPECT_EQ(output, expectedOutput);
+
+  // The encoding round-trips, and is much smaller than the diff image.
+  std::vector<uint8_t> encoded;
+  ASSERT_TRUE(encodeSparseDiff(sparse, encoded));
+  EXPECT_LT(encoded.size(), expectedOutput.size() / 20);
+
+  const std::optional<SparseDiff> decoded = decodeSparseDiff(encoded);
+  ASSERT_TRUE(decoded.has_value());
+  EXPECT_EQ(decoded->width, sparse.width);
+  EXPECT_EQ(decoded->height, sparse.height);
+  ASSERT_EQ(decoded->runs.size(), sparse.runs.size());
+  for (size_t i = 0; i < sparse.runs.size(); ++i) {
+    EXPECT_EQ(decoded->runs[i].x, sparse.runs[i].x) << "run " << i;
+    EXPECT_EQ(decoded->runs[i].y, sparse.runs[i].y) << "run " << i;
+    EXPECT_EQ(decoded->runs[i].length, sparse.runs[i].length) << "run " << i;
+    EXPECT_EQ(decoded->runs[i].kind, sparse.runs[i].kind) << "run " << i;
+  }
+
+  // Identical images have no runs, and the capacity is reused.
+  EXPECT_EQ(pixelmatchSparse(img1.data, img1.data, img1.width, img1.height, img1.strideInPixels,
+                             sparse, options),
+            0);
+  EXPECT_TRUE(sparse.runs.empty());
+}
+
+TEST(Pixelmatch, SparseDiffDecodeRejectsInvalidData) {
+  SparseDiff sparse;
+  sparse.width = 300;
+  sparse.height = 2;
+  sparse.runs = {{0, 0, 3, DiffRunKind::kDiff},
+                 {200, 0, 100, DiffRunKind::kDiffAlt},
+                 {5, 1, 1, DiffRunKind::kAntialiased}};
+
+  std::vector<uint8_t> encoded;
+  ASSERT_TRUE(encodeSparseDiff(sparse, encoded));
+  ASSERT_TRUE(decodeSparseDiff(encoded).has_value());
+
+  // Truncated at every length, or with trailing data.
+  for (size_t size = 0; size < encoded.size(); ++size) {
+    EXPECT_FALSE(decodeSparseDiff(span<const uint8_t>(encoded.data(), size)).has_value())
+        << "size " << size;
+  }
+  std::vector<uint8_t> trailing = encoded;
+  trailing.push_back(0);
+  EXPECT_FALSE(decodeSparseDiff(trailing).has_value());
+
+  // Bad magic or version.
+  std::vector<uint8_t> corrupt = encoded;
+  corrupt[0] = 'X';
+  EXPECT_FALSE(decodeSparseDiff(corrupt).has_value());
+  corrupt = encoded;
+  corrupt[4] = 2;
+  EXPECT_FALSE(decodeSparseDiff(corrupt).has_value());
+
+  // A run past the right edge: a width of 299 instead of 300 (two varint bytes, 0xAB 0x02).
+  corrupt = encoded;
+  ASSERT_EQ(corrupt[5], 0xAC);
+  corrupt[5] = 0xAB;
+  EXPECT_FALSE(decodeSparseDiff(corrupt).has_value());
+
+  // A run count that the data cannot hold.
+  corrupt = encoded;
+  ASSERT_EQ(corrupt[8], 3);
+  corrupt[8] = 0x7F;
+  EXPECT_FALSE(decodeSparseDiff(corrupt).has_value());
+}
+
+TEST(PixelmatchDeathTest, SparseDiffRunsOutOfOrder) {
+  SparseDiff sparse;
+  sparse.width = 4;
+  sparse.height = 1;
+  sparse.runs = {{2, 0, 1, DiffRunKind::kDiff}, {0, 0, 1, DiffRunKind::kDiff}};
+
+  std::array<uint8_t, 16> img{};
+  std::array<uint8_t, 16> output{};
+  EXPECT_DEBUG_DEATH(renderSparseDiff(sparse, img, 4, output),
+                     "Sparse diff runs are out of order or bounds");
+}
+
+TEST(PixelmatchDeathTest, UnsortedThresholds) {
+  std::array<uint8_t, 8> img1;
+  std::array<uint8_t, 8> img2;
+  const std::array<float, 2> thresholds = {0.2f, 0.1f};
+  EXPECT_DEBUG_DEATH(pixelmatchThresholds(img1, img2, 2, 1, 2, thresholds),
+                     "Thresholds must be sorted in ascending order");
+
+  // Negative thresholds are rejected even when sorted, since their squares are not.
+  const std::array<float, 2> negativeThresholds = {-0.2f, 0.1f};
+  EXPECT_DEBUG_DEATH(pixelmatchThresholds(img1, img2, 2, 1, 2, negativeThresholds),
+                     "Thresholds must not be negative");
+}
+
+TEST(Pixelmatch, ExecutorDoesNotChangeResult) {
+  const Image img1 = loadTestImage("tests/testdata/7a.png");
+  const Image img2 = loadTestImage("tests/testdata/7b.png");
+
+  ThreadExecutor executor(4);
+  for (const int tileSize : {0, 32, 48}) {
+    SCOPED_TRACE(testing::Message() << "tileSize=" << tileSize);
+
+    Options options = defaultTestOptions();
+    options.tileSize = tileSize;
+    std::vector<uint8_t> expectedOutput(img1.data.size());
+    const int expectedDiff = pixelmatch(img1.data, img2.data, expectedOutput, img1.width,
+                                        img1.height, img1.strideInPixels, options);
+
+    options.executor = &executor;
+    std::vector<uint8_t> output(img1.data.size());
+    EXPECT_EQ(pixelmatch(img1.data, img2.data, output, img1.width, img1.height,
+                         img1.strideInPixels, options),
+              expectedDiff);
+    EXPECT_EQ(output, expectedOutput);
+  }
+}
+
 TEST(PixelmatchDeathTest, NegativeDimensions) {
   std::array<uint8_t, 8> img1;
   std::array<uint8_t, 8> img2;
@@ -303,6 +943,13 @@ TEST(PixelmatchDeathTest, InvalidStride) {
                      "Stride must be greater than width");
 }
 
+TEST(PixelmatchDeathTest, SubImageLargerThanImage) {
+  std::array<uint8_t, 8> img;
+  std::array<uint8_t, 16> subImg;
+  EXPECT_DEBUG_DEATH(findSubImage(img, 2, 1, 2, subImg, 2, 2, 2, pixelmatch::span<uint8_t>()),
+                     "Sub-image must fit inside the image");
+}
+
 TEST(Pixelmatch, SingleChannelDifferences) {
   EXPECT_TRUE(compareSinglePixel(Color{0, 0, 0, 255}, Color{0, 0, 0, 255}));
 
@@ -391,4 +1038,95 @@ TEST(Pixelmatch, ColorDifferenceInAdjacentPixel) {
   EXPECT_EQ(pixelmatch(img1, img2, output, width, height, strideInPixels, options), 2);
 }
 
+TEST(Pixelmatch, EstimateBoundsExactCount) {
+  const Image img1 = loadTestImage("tests/testdata/4a.png");
+  const Image img2 = loadTestImage("tests/testdata/4b.png");
+
+  const std::optional<DiffEstimate> estimate = estimatePixelmatch(
+      img1.data, img2.data, img1.width, img1.height, img1.strideInPixels, defaultTestOptions());
+  ASSERT_TRUE(estimate.has_value());
+
+  const int exact = pixelmatch(img1.data, img2.data, span<uint8_t>(), img1.width, img1.height,
+                               img1.strideInPixels, defaultTestOptions());
+  EXPECT_EQ(estimate->sampledPixels, ((img1.width + 3) / 4) * ((img1.height + 3) / 4));
+  EXPECT_LE(estimate->lowerBound, exact);
+  EXPECT_GE(estimate->upperBound, exact);
+}
+
+TEST(Pixelmatch, QuickCheck) {
+  const Image img1 = loadTestImage("tests/testdata/4a.png");
+  const Image img2 = loadTestImage("tests/testdata/4b.png");
+
+  // Clearly broken, answered from the estimate alone.
+  {
+    const std::optional<QuickCheckResult> result =
+        pixelmatchQuickCheck(img1.data, img2.data, img1.width, img1.height, img1.strideInPixels,
+                             /*allowedDiff=*/0, defaultTestOptions());
+    ASSERT_TRUE(result.has_value());
+    EXPECT_TRUE(result->exceedsAllowedDiff);
+    EXPECT_FALSE(result->exact);
+  }
+
+  // Clearly same, answered from the estimate alone.
+  {
+    const std::optional<QuickCheckResult> result = pixelmatchQuickCheck(
+        img1.data, img2.data, img1.width, img1.height, img1.strideInPixels,
+        /*allowedDiff=*/img1.width * img1.height, defaultTestOptions());
+    ASSERT_TRUE(result.has_value());
+    EXPECT_FALSE(result->exceedsAllowedDiff);
+    EXPECT_FALSE(result->exact);
+  }
+
+  // Close to the allowed count, escalates to the full comparison.
+  {
+    const std::optional<QuickCheckResult> result =
+        pixelmatchQuickCheck(img1.data, img2.data, img1.width, img1.height, img1.strideInPixels,
+                             /*allowedDiff=*/36049, defaultTestOptions());
+    ASSERT_TRUE(result.has_value());
+    EXPECT_FALSE(result->exceedsAllowedDiff);
+    EXPECT_TRUE(result->exact);
+    EXPECT_EQ(result->diff, 36049);
+  }
+}
+
+TEST(Pixelmatch, QuickCheckIdentical) {
+  const Image img = loadTestImage("tests/testdata/1a.png");
+
+  const std::optional<QuickCheckResult> result =
+      pixelmatchQuickCheck(img.data, img.data, img.width, img.height, img.strideInPixels,
+                           /*allowedDiff=*/0, defaultTestOptions());
+  ASSERT_TRUE(result.has_value());
+  EXPECT_FALSE(result->exceedsAllowedDiff);
+  EXPECT_TRUE(result->exact);
+  EXPECT_EQ(result->diff, 0);
+
+  // Answered by comparing the images directly, without sampling.
+  EXPECT_EQ(result->estimate.sampledPixels, 0);
+}
+
+TEST(Pixelmatch, QuickCheckZeroAllowedDiff) {
+  const Image img1 = loadTestImage("tests/testdata/1a.png");
+  Image img2 = img1;
+
+  // A single different pixel, which the sample misses.
+  const size_t pos = (5 * img2.strideInPixels + 3) * 4;
+  img2.data[pos + 0] = static_cast<uint8_t>(255 - img2.data[pos + 0]);
+  img2.data[pos + 1] = static_cast<uint8_t>(255 - img2.data[pos + 1]);
+  img2.data[pos + 2] = static_cast<uint8_t>(255 - img2.data[pos + 2]);
+
+  const std::optional<DiffEstimate> estimate = estimatePixelmatch(
+      img1.data, img2.data, img1.width, img1.height, img1.strideInPixels, defaultTestOptions());
+  ASSERT_TRUE(estimate.has_value());
+  ASSERT_EQ(estimate->sampledDiff, 0);
+
+  // The estimate cannot rule out the difference, so the full comparison finds it.
+  const std::optional<QuickCheckResult> result =
+      pixelmatchQuickCheck(img1.data, img2.data, img1.width, img1.height, img1.strideInPixels,
+                           /*allowedDiff=*/0, defaultTestOptions());
+  ASSERT_TRUE(result.has_value());
+  EXPECT_TRUE(result->exceedsAllowedDiff);
+  EXPECT_TRUE(result->exact);
+  EXPECT_EQ(result->diff, 1);
+}
+
 }  // namespace pixelmatch
@@ -0,0 +1,163 @@
+#include "pixelmatch_variants.h"
+
+#include <pixelmatch/executor.h>
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+namespace pixelmatch {
+
+std::vector<VariantResult> runPixelmatchVariants(span<const uint8_t> img1,
+                                                 span<const uint8_t> img2, int width, int height,
+                                                 size_t strideInPixels, const Options& options) {
+  std::vector<VariantResult> results;
+  const auto addResult = [&](std::string name, bool hasOutput) -> VariantResult& {
+    VariantResult& result = results.emplace_back();
+    result.name = std::move(name);
+    result.hasOutput = hasOutput;
+    if (hasOutput) {
+      result.output.assign(img1.size(), 0);
+    }
+    return result;
+  };
+
+  Options baseOptions = options;
+  baseOptions.tileSize = 0;
+  baseOptions.executor = nullptr;
+
+  {
+    VariantResult& result = addResult("pixelmatch", true);
+    result.diff = pixelmatch(img1, img2, result.output, width, height, strideInPixels, baseOptions);
+  }
+
+  {
+    VariantResult& result = addResult("pixelmatch without output", false);
+    result.diff =
+        pixelmatch(img1, img2, span<uint8_t>(), width, height, strideInPixels, baseOptions);
+  }
+
+  // Odd tile sizes leave partial tiles on the right and bottom edges.
+  for (const int tileSize : {1, 7, 32, 100}) {
+    Options tiledOptions = baseOptions;
+    tiledOptions.tileSize = tileSize;
+
+    VariantResult& result = addResult("tileSize=" + std::to_string(tileSize), true);
+    result.diff =
+        pixelmatch(img1, img2, result.output, width, height, strideInPixels, tiledOptions);
+  }
+
+  ThreadExecutor executor(4);
+  for (const int tileSize : {0, 24}) {
+    Options parallelOptions = baseOptions;
+    parallelOptions.executor = &executor;
+    parallelOptions.tileSize = tileSize;
+
+    VariantResult& result = addResult("executor, tileSize=" + std::to_string(tileSize), true);
+    result.diff =
+        pixelmatch(img1, img2, result.output, width, height, strideInPixels, parallelOptions);
+  }
+
+  {
+    std::vector<float> deltas(img1.size() / 4);
+    VariantResult& result = addResult("pixelmatchWithDeltas<float>", true);
+    result.diff = pixelmatchWithDeltas(img1, img2, result.output, deltas, width, height,
+                                       strideInPixels, baseOptions);
+  }
+
+  {
+    Options tiledOptions = baseOptions;
+    tiledOptions.tileSize = 16;
+
+    std::vector<float> deltas(img1.size() / 4);
+    VariantResult& result = addResult("pixelmatchWithDeltas<float>, tileSize=16", true);
+    result.diff = pixelmatchWithDeltas(img1, img2, result.output, deltas, width, height,
+                                       strideInPixels, tiledOptions);
+  }
+
+  {
+    std::vector<uint16_t> deltas(img1.size() / 4);
+    VariantResult& result = addResult("pixelmatchWithDeltas<uint16_t>", true);
+    result.diff = pixelmatchWithDeltas(img1, img2, result.output, deltas, width, height,
+                                       strideInPixels, baseOptions);
+  }
+
+  {
+    // The threshold of the options in the middle of others, to check the bucketing.
+    const std::array<float, 3> thresholds = {0.0f, options.threshold, 1.0f};
+    const std::optional<std::vector<int>> diffs = pixelmatchThresholds(
+        img1, img2, width, height, strideInPixels, thresholds, baseOptions);
+
+    VariantResult& result = addResult("pixelmatchThresholds", false);
+    result.diff = diffs ? (*diffs)[1] : -1;
+  }
+
+  {
+    Options parallelOptions = baseOptions;
+    parallelOptions.executor = &executor;
+    const std::array<float, 3> thresholds = {0.0f, options.threshold, 1.0f};
+    const std::optional<std::vector<int>> diffs = pixelmatchThresholds(
+        img1, img2, width, height, strideInPixels, thresholds, parallelOptions);
+
+    VariantResult& result = addResult("pixelmatchThresholds, executor", false);
+    result.diff = diffs ? (*diffs)[1] : -1;
+  }
+
+  {
+    SampleOptions sampleOptions;
+    sampleOptions.cellSize = 1;
+    const std::optional<DiffEstimate> estimate =
+        estimatePixelmatch(img1, img2, width, height, strideInPixels, baseOptions, sampleOptions);
+
+    VariantResult& result = addResult("estimatePixelmatch, cellSize=1", false);
+    result.diff = estimate ? static_cast<int>(std::lround(estimate->estimatedDiff)) : -1;
+  }
+
+  {
+    VariantResult& result = addResult("pixelmatchAligned, maxShift=0", true);
+    const std::optional<AlignedResult> aligned = pixelmatchAligned(
+        img1, img2, result.output, width, height, strideInPixels, 0, baseOptions);
+    result.diff = aligned ? aligned->diff : -1;
+  }
+
+  {
+    // A sub-image as large as the image can only be found at the origin.
+    VariantResult& result = addResult("findSubImage, same size", true);
+    const std::optional<SubImageMatch> match =
+        findSubImage(img1, width, height, strideInPixels, img2, width, height, strideInPixels,
+                     result.output, baseOptions);
+    result.diff = match ? match->diff : -1;
+  }
+
+  {
+    SparseDiff sparse;
+    VariantResult& result = addResult("pixelmatchSparse", true);
+    result.diff =
+        pixelmatchSparse(img1, img2, width, height, strideInPixels, sparse, baseOptions);
+    if (!renderSparseDiff(sparse, img1, strideInPixels, result.output, baseOptions)) {
+      result.diff = -1;
+    }
+  }
+
+  {
+    // Runs collected in tiles and parallel bands, and round-tripped through the binary format.
+    Options parallelOptions = baseOptions;
+    parallelOptions.executor = &executor;
+    parallelOptions.tileSize = 24;
+
+    SparseDiff sparse;
+    std::vector<uint8_t> encoded;
+    VariantResult& result = addResult("pixelmatchSparse, executor, tileSize=24, encoded", true);
+    result.diff =
+        pixelmatchSparse(img1, img2, width, height, strideInPixels, sparse, parallelOptions);
+    const std::optional<SparseDiff> decoded =
+        encodeSparseDiff(sparse, encoded) ? decodeSparseDiff(encoded) : std::nullopt;
+    if (!decoded || !renderSparseDiff(*decoded, img1, strideInPixels, result.output, baseOptions)) {
+      result.diff = -1;
+    }
+  }
+
+  return results;
+}
+
+}  // namespace pixelmatch
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <pixelmatch/pixelmatch.h>
+
+#include <string>
+#include <vector>
+
+namespace pixelmatch {
+
+/**
+ * Result of one optimized code path of the library, to be compared against
+ * \ref reference::pixelmatch.
+ */
+struct VariantResult {
+  std::string name;             //!< Name of the variant, for failure messages.
+  int diff = 0;                 //!< Number of different pixels reported by the variant.
+  bool hasOutput = false;       //!< Whether the variant draws a diff image.
+  std::vector<uint8_t> output;  //!< Diff image, if \ref hasOutput; padding is left zeroed.
+};
+
+/**
+ * Run every optimized variant of the 8-bit comparison that must match the reference exactly:
+ * row and tiled traversal, parallel bands on an executor, the delta plane and multiple-threshold
+ * entry points, the sampled estimate with one sample per pixel, the aligned and sub-image
+ * comparisons when they reduce to a plain comparison, and sparse diffs rendered back to images.
+ *
+ * @param options Options shared by all variants. Traversal options, such as tileSize and
+ *                executor, are overridden by each variant.
+ */
+std::vector<VariantResult> runPixelmatchVariants(span<const uint8_t> img1,
+                                                 span<const uint8_t> img2, int width, int height,
+                                                 size_t strideInPixels, const Options& options);
+
+}  // namespace pixelmatch
@@ -0,0 +1,152 @@
+#include "synthetic_images.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace pixelmatch {
+
+namespace {
+
+struct Circle {
+  float cx;
+  float cy;
+  float radius;
+  uint8_t color[4];
+};
+
+uint8_t mix(uint8_t dst, uint8_t src, float coverage) {
+  return static_cast<uint8_t>(std::lround(dst + (src - dst) * coverage));
+}
+
+/// Draw a circle with anti-aliased edges, using the pixel coverage of the edge.
+void drawCircle(std::vector<uint8_t>& img, int width, int height, size_t strideInPixels,
+                const Circle& circle, float radiusOffset) {
+  const float radius = circle.radius + radiusOffset;
+  const int x0 = std::max(0, static_cast<int>(circle.cx - radius - 1));
+  const int x1 = std::min(width - 1, static_cast<int>(circle.cx + radius + 1));
+  const int y0 = std::max(0, static_cast<int>(circle.cy - radius - 1));
+  const int y1 = std::min(height - 1, static_cast<int>(circle.cy + radius + 1));
+
+  for (int y = y0; y <= y1; ++y) {
+    for (int x = x0; x <= x1; ++x) {
+      const float dx = x + 0.5f - circle.cx;
+      const float dy = y + 0.5f - circle.cy;
+      const float coverage =
+          std::clamp(radius - std::sqrt(dx * dx + dy * dy) + 0.5f, 0.0f, 1.0f);
+      if (coverage <= 0.0f) {
+        continue;
+      }
+
+      uint8_t* pixel = &img[(y * strideInPixels + x) * 4];
+      for (int c = 0; c < 4; ++c) {
+        pixel[c] = mix(pixel[c], circle.color[c], coverage);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+SyntheticImagePair generateSyntheticImagePair(int width, int height, size_t strideInPixels,
+                                              SyntheticDiff kind, uint64_t seed, bool alpha) {
+  Random random(seed);
+
+  SyntheticImagePair result{width, height, strideInPixels,
+                            std::vector<uint8_t>(strideInPixels * height * 4), {}};
+  std::vector<uint8_t>& img = result.img1;
+
+  // Background gradient, with noise in the padding beyond the image width.
+  for (int y = 0; y < height; ++y) {
+    for (size_t x = 0; x < strideInPixels; ++x) {
+      uint8_t* pixel = &img[(y * strideInPixels + x) * 4];
+      if (x < static_cast<size_t>(width)) {
+        pixel[0] = static_cast<uint8_t>(x * 255 / width);
+        pixel[1] = static_cast<uint8_t>(y * 255 / height);
+        pixel[2] = 160;
+        pixel[3] = 255;
+      } else {
+        for (int c = 0; c < 4; ++c) {
+          pixel[c] = static_cast<uint8_t>(random.next());
+        }
+      }
+    }
+  }
+
+  // Shapes, roughly one per 64x64 block.
+  const int numCircles = std::max(1, width * height / 4096);
+  std::vector<Circle> circles;
+  circles.reserve(numCircles);
+  for (int i = 0; i < numCircles; ++i) {
+    Circle circle;
+    circle.cx = random.nextFloat() * width;
+    circle.cy = random.nextFloat() * height;
+    circle.radius = 2.0f + random.nextFloat() * 14.0f;
+    for (int c = 0; c < 3; ++c) {
+      circle.color[c] = static_cast<uint8_t>(random.next());
+    }
+    circle.color[3] = alpha ? static_cast<uint8_t>(64 + random.nextInt(192)) : 255;
+    circles.push_back(circle);
+  }
+
+  // Copy the background, with different padding so that comparing padding would be detected.
+  result.img2 = img;
+  for (int y = 0; y < height; ++y) {
+    for (size_t x = width; x < strideInPixels; ++x) {
+      for (int c = 0; c < 4; ++c) {
+        result.img2[(y * strideInPixels + x) * 4 + c] = static_cast<uint8_t>(random.next());
+      }
+    }
+  }
+
+  for (const Circle& circle : circles) {
+    drawCircle(result.img1, width, height, strideInPixels, circle, 0.0f);
+    drawCircle(result.img2, width, height, strideInPixels, circle,
+               kind == SyntheticDiff::kAntialiased ? 0.4f : 0.0f);
+  }
+
+  std::vector<uint8_t>& img2 = result.img2;
+  if (kind == SyntheticDiff::kSparse) {
+    const int numRects = std::max(1, width * height / (256 * 256));
+    for (int i = 0; i < numRects; ++i) {
+      const int rectX = random.nextInt(width);
+      const int rectY = random.nextInt(height);
+      const int rectWidth = std::min(width - rectX, 1 + random.nextInt(8));
+      const int rectHeight = std::min(height - rectY, 1 + random.nextInt(8));
+      const uint8_t value = static_cast<uint8_t>(random.next());
+
+      for (int y = rectY; y < rectY + rectHeight; ++y) {
+        for (int x = rectX; x < rectX + rectWidth; ++x) {
+          uint8_t* pixel = &img2[(y * strideInPixels + x) * 4];
+          pixel[0] = value;
+          pixel[1] = static_cast<uint8_t>(255 - value);
+          pixel[2] = value;
+          pixel[3] = 255;
+        }
+      }
+    }
+  } else if (kind == SyntheticDiff::kDense) {
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        uint8_t* pixel = &img2[(y * strideInPixels + x) * 4];
+        for (int c = 0; c < 3; ++c) {
+          const int noise = random.nextInt(81) - 40;
+          pixel[c] = static_cast<uint8_t>(std::clamp(pixel[c] + noise, 0, 255));
+        }
+      }
+    }
+  }
+
+  return result;
+}
+
+const char* syntheticDiffName(SyntheticDiff kind) {
+  switch (kind) {
+    case SyntheticDiff::kSparse: return "sparse";
+    case SyntheticDiff::kDense: return "dense";
+    case SyntheticDiff::kAntialiased: return "antialiased";
+  }
+
+  return "unknown";
+}
+
+}  // namespace pixelmatch
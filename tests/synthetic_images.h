@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pixelmatch {
+
+/**
+ * SplitMix64 random number generator, used instead of <random> so that generated images and test
+ * cases are identical on every platform.
+ */
+class Random {
+public:
+  explicit Random(uint64_t seed) : state_(seed) {}
+
+  uint64_t next() {
+    uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+
+  /// Returns a value in [0, bound).
+  int nextInt(int bound) { return static_cast<int>(next() % static_cast<uint64_t>(bound)); }
+
+  /// Returns a value in [0, 1).
+  float nextFloat() { return static_cast<float>(next() >> 40) / static_cast<float>(1 << 24); }
+
+  bool nextBool() { return (next() & 1) != 0; }
+  uint8_t nextByte() { return static_cast<uint8_t>(next()); }
+
+private:
+  uint64_t state_;
+};
+
+/**
+ * Kind of difference between the two images of a \ref SyntheticImagePair.
+ */
+enum class SyntheticDiff {
+  kSparse,       //!< A few small rectangles are changed.
+  kDense,        //!< Every pixel has random noise added.
+  kAntialiased,  //!< Anti-aliased shape edges are shifted by a fraction of a pixel.
+};
+
+/**
+ * Pair of deterministically generated images, for benchmarks and large-image tests.
+ */
+struct SyntheticImagePair {
+  int width;                  //!< Image width in pixels.
+  int height;                 //!< Image height in pixels.
+  size_t strideInPixels;      //!< Image stride, in pixels.
+  std::vector<uint8_t> img1;  //!< First image, as RGBA-encoded pixels.
+  std::vector<uint8_t> img2;  //!< Second image, same size as \ref img1.
+};
+
+/**
+ * Generate a pair of images containing gradients and anti-aliased shapes, where the second image
+ * differs from the first according to \ref kind. The same arguments always produce the same images.
+ *
+ * @param width Width of the images, in pixels.
+ * @param height Height of the images, in pixels.
+ * @param strideInPixels Stride of the images, must be >= width. Padding pixels are filled with
+ *                       noise, so that they would be detected if they were compared.
+ * @param kind Kind of difference to introduce.
+ * @param seed Random seed.
+ * @param alpha If true, shapes are drawn with partially transparent colors.
+ */
+SyntheticImagePair generateSyntheticImagePair(int width, int height, size_t strideInPixels,
+                                              SyntheticDiff kind, uint64_t seed,
+                                              bool alpha = false);
+
+/// Returns a human-readable name for \ref kind.
+const char* syntheticDiffName(SyntheticDiff kind);
+
+}  // namespace pixelmatch
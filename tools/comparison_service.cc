@@ -0,0 +1,137 @@
+#include "comparison_service.h"
+
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+namespace pixelmatch {
+
+namespace {
+
+std::vector<std::string> splitFields(const std::string& line) {
+  std::vector<std::string> fields;
+  size_t start = 0;
+  while (start <= line.size()) {
+    const size_t end = line.find('\t', start);
+    fields.push_back(line.substr(start, end == std::string::npos ? std::string::npos : end - start));
+    if (end == std::string::npos) {
+      break;
+    }
+
+    start = end + 1;
+  }
+
+  return fields;
+}
+
+bool parseFloat(const std::string& value, float& result) {
+  char* end = nullptr;
+  result = std::strtof(value.c_str(), &end);
+  return !value.empty() && end == value.c_str() + value.size();
+}
+
+std::string error(const std::string& message) {
+  return "ERROR " + message;
+}
+
+}  // namespace
+
+ComparisonService::ComparisonService(size_t cacheBudgetBytes) noexcept
+    : goldenCache_(cacheBudgetBytes) {}
+
+std::string ComparisonService::handleRequest(const std::string& request) {
+  std::string line = request;
+  if (!line.empty() && line.back() == '\r') {
+    line.pop_back();
+  }
+
+  const std::vector<std::string> fields = splitFields(line);
+  if (fields[0] == "COMPARE") {
+    return handleCompare(fields);
+  } else if (fields[0] == "STATS" && fields.size() == 1) {
+    return handleStats();
+  }
+
+  return error("unknown request");
+}
+
+std::string ComparisonService::handleCompare(const std::vector<std::string>& fields) {
+  if (fields.size() < 3) {
+    return error("usage: COMPARE <golden> <candidate> [key=value...]");
+  }
+
+  Options options;
+  std::string diffFilename;
+  for (size_t i = 3; i < fields.size(); ++i) {
+    const size_t equals = fields[i].find('=');
+    if (equals == std::string::npos) {
+      return error("invalid option: " + fields[i]);
+    }
+
+    const std::string key = fields[i].substr(0, equals);
+    const std::string value = fields[i].substr(equals + 1);
+    if (key == "threshold") {
+      if (!parseFloat(value, options.threshold)) {
+        return error("invalid threshold: " + value);
+      }
+    } else if (key == "alpha") {
+      if (!parseFloat(value, options.alpha)) {
+        return error("invalid alpha: " + value);
+      }
+    } else if (key == "includeAA") {
+      if (value != "0" && value != "1") {
+        return error("invalid includeAA: " + value);
+      }
+      options.includeAA = value == "1";
+    } else if (key == "diff") {
+      diffFilename = value;
+    } else {
+      return error("unknown option: " + key);
+    }
+  }
+
+  const std::shared_ptr<const Image> golden = goldenCache_.get(fields[1]);
+  if (!golden) {
+    return error("failed to load golden: " + fields[1]);
+  }
+
+  const std::optional<Image> candidate = readRgbaImageFromPngFile(fields[2].c_str());
+  if (!candidate) {
+    return error("failed to load candidate: " + fields[2]);
+  }
+
+  if (golden->width != candidate->width || golden->height != candidate->height) {
+    return error("image sizes do not match");
+  }
+
+  std::vector<uint8_t> diff;
+  if (!diffFilename.empty()) {
+    diff.resize(golden->data.size());
+  }
+
+  const int result = pixelmatch(golden->data, candidate->data, diff, golden->width,
+                                golden->height, golden->strideInPixels, options);
+  if (result < 0) {
+    return error("comparison failed");
+  }
+
+  if (!diffFilename.empty() &&
+      !writeRgbaPixelsToPngFile(diffFilename.c_str(), diff, golden->width, golden->height,
+                                golden->strideInPixels)) {
+    return error("failed to write diff: " + diffFilename);
+  }
+
+  return "OK " + std::to_string(result);
+}
+
+std::string ComparisonService::handleStats() {
+  const ImageCache::Stats stats = goldenCache_.stats();
+
+  std::ostringstream response;
+  response << "OK hits=" << stats.hits << " misses=" << stats.misses
+           << " evictions=" << stats.evictions << " entries=" << stats.entries
+           << " bytes=" << stats.bytesUsed;
+  return response.str();
+}
+
+}  // namespace pixelmatch
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <pixelmatch/image_cache.h>
+
+#include <string>
+#include <vector>
+
+namespace pixelmatch {
+
+/**
+ * Handles requests for `pixelmatch_server`, comparing candidate images against goldens which are
+ * kept decoded in an \ref ImageCache.
+ *
+ * Requests and responses are single lines, with fields separated by tabs so that paths may contain
+ * spaces:
+ *
+ * - `COMPARE <golden> <candidate> [key=value...]` compares the candidate against the golden.
+ *   Supported keys are `threshold`, `includeAA` (0 or 1), `alpha` and `diff` (a path to write the
+ *   diff PNG to). Responds with `OK <diff count>`.
+ * - `STATS` responds with `OK hits=<n> misses=<n> evictions=<n> entries=<n> bytes=<n>`.
+ *
+ * Errors are returned as `ERROR <message>`.
+ */
+class ComparisonService {
+public:
+  /**
+   * Construct the service.
+   *
+   * @param cacheBudgetBytes Memory budget for the decoded golden images, in bytes.
+   */
+  explicit ComparisonService(size_t cacheBudgetBytes) noexcept;
+
+  /**
+   * Handle a single request, thread-safe.
+   *
+   * Invalid requests and images that fail to load get an error response. Running out of memory,
+   * such as for the diff of a large image, throws std::bad_alloc, which the caller should turn
+   * into an error for this request only.
+   *
+   * @param request Request line, without the trailing newline.
+   * @return Response line, without the trailing newline.
+   */
+  std::string handleRequest(const std::string& request);
+
+private:
+  std::string handleCompare(const std::vector<std::string>& fields);
+  std::string handleStats();
+
+  ImageCache goldenCache_;
+};
+
+}  // namespace pixelmatch
@@ -0,0 +1,551 @@
+/**
+ * pixelmatch_cli: compares PNG images from the command line, either a single pair of files or two
+ * directory trees, matching files by relative path.
+ *
+ * Usage:
+ *   pixelmatch_cli [options] <img1.png> <img2.png> [diff.png]
+ *   pixelmatch_cli [options] <dir1> <dir2>
+ *
+ * Run with --help for the list of options.
+ *
+ * Exits with 0 if all images match, 1 if any images differ, are missing or fail to compare, and 2 on
+ * usage errors or if a directory cannot be listed.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pixelmatch/executor.h"
+#include "pixelmatch/image_utils.h"
+#include "pixelmatch/pixelmatch.h"
+
+namespace pixelmatch {
+namespace {
+
+namespace fs = std::filesystem;
+
+constexpr const char* kUsage = R"(Usage:
+  pixelmatch_cli [options] <img1.png> <img2.png> [diff.png]
+  pixelmatch_cli [options] <dir1> <dir2>
+
+Options:
+  --threshold=<f>   Matching threshold, 0 to 1. Default 0.1.
+  --metric=<name>   Color difference metric: yiq, oklab or ciede2000. Default yiq.
+  --include-aa      Count anti-aliased pixels as differences.
+  --alpha=<f>       Opacity of the original image in the diff output. Default 0.1.
+  --diff-mask       Draw the diff over a transparent background.
+  --max-diff=<n>    Number of different pixels allowed before a pair fails. Default 0.
+  --diff-dir=<dir>  In directory mode, write diffs of failing pairs to this directory.
+  --sparse-diff     Write diffs as run-length encoded sparse diffs instead of PNGs, with the
+                    .pmsd extension in directory mode. Much smaller and faster to write for
+                    mostly-matching images.
+  -j <n>            Number of threads to compare pairs, or a single pair, in parallel.
+                    Default: number of cores.
+  --json=<path>     Write a JSON summary to this file, or "-" for stdout.
+)";
+
+/// Maximum value of -j, well above any core count, so that a typo cannot start a huge pool.
+constexpr int kMaxJobs = 1024;
+
+struct CliOptions {
+  Options options;
+  int maxDiff = 0;
+  int jobs = 0;
+  bool sparseDiff = false;
+  std::string diffDir;
+  std::string jsonPath;
+  std::vector<std::string> positional;
+};
+
+enum class Status { kMatch, kDifferent, kMissing, kError };
+
+const char* statusName(Status status) {
+  switch (status) {
+    case Status::kMatch: return "match";
+    case Status::kDifferent: return "different";
+    case Status::kMissing: return "missing";
+    case Status::kError: return "error";
+  }
+
+  return "unknown";
+}
+
+struct ComparisonJob {
+  std::string name;  //!< Relative path in directory mode, or the first filename.
+  fs::path file1;
+  fs::path file2;
+  fs::path diffFile;  //!< Where to write the diff if the comparison fails, or empty.
+};
+
+struct ComparisonResult {
+  Status status = Status::kError;
+  std::string message;
+  int diffPixels = 0;
+  int64_t totalPixels = 0;
+  double loadMs = 0.0;
+  double compareMs = 0.0;
+  double writeMs = 0.0;
+};
+
+double msSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+bool writeSparseDiffFile(const fs::path& path, const SparseDiff& sparseDiff) {
+  std::vector<uint8_t> encoded;
+  if (!encodeSparseDiff(sparseDiff, encoded)) {
+    return false;
+  }
+
+  std::ofstream out(path, std::ios::binary);
+  out.write(reinterpret_cast<const char*>(encoded.data()),
+            static_cast<std::streamsize>(encoded.size()));
+  return out.good();
+}
+
+/**
+ * Load and compare a pair of images.
+ *
+ * @param ioExecutor Executor to load the first image on while the second is loaded on the calling
+ *                   thread, or nullptr to load both on the calling thread.
+ */
+ComparisonResult runComparison(const ComparisonJob& job, const CliOptions& cli,
+                               Executor* ioExecutor) {
+  ComparisonResult result;
+  std::error_code ec1;
+  std::error_code ec2;
+  const bool exists1 = fs::exists(job.file1, ec1);
+  const bool exists2 = fs::exists(job.file2, ec2);
+  if (ec1 || ec2) {
+    result.message = "failed to access " + (ec1 ? job.file1 : job.file2).string() + ": " +
+                     (ec1 ? ec1 : ec2).message();
+    return result;
+  } else if (!exists1 || !exists2) {
+    result.status = Status::kMissing;
+    result.message = "missing " + (exists1 ? job.file2 : job.file1).string();
+    return result;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::future<std::optional<Image>> futureImg1 = readRgbaImageFromPngFileAsync(job.file1.string(), ioExecutor);
+  const std::optional<Image> img2 = readRgbaImageFromPngFile(job.file2.string().c_str());
+  const std::optional<Image> img1 = futureImg1.get();
+  result.loadMs = msSince(start);
+
+  if (!img1 || !img2) {
+    result.message = "failed to load " + (img1 ? job.file2 : job.file1).string();
+    return result;
+  }
+
+  if (img1->width != img2->width || img1->height != img2->height) {
+    result.status = Status::kDifferent;
+    result.message = "image dimensions do not match";
+    result.diffPixels = -1;
+    return result;
+  }
+
+  result.totalPixels = static_cast<int64_t>(img1->width) * img1->height;
+
+  std::vector<uint8_t> diff;
+  SparseDiff sparseDiff;
+  if (!job.diffFile.empty() && !cli.sparseDiff) {
+    diff.resize(img1->data.size());
+  }
+
+  start = std::chrono::steady_clock::now();
+  if (!job.diffFile.empty() && cli.sparseDiff) {
+    result.diffPixels = pixelmatchSparse(img1->data, img2->data, img1->width, img1->height,
+                                         img1->strideInPixels, sparseDiff, cli.options);
+  } else {
+    result.diffPixels = pixelmatch(img1->data, img2->data, diff, img1->width, img1->height,
+                                   img1->strideInPixels, cli.options);
+  }
+  result.compareMs = msSince(start);
+
+  if (result.diffPixels < 0) {
+    result.message = "comparison failed";
+    return result;
+  }
+
+  if (result.diffPixels <= cli.maxDiff) {
+    result.status = Status::kMatch;
+    return result;
+  }
+
+  result.status = Status::kDifferent;
+  if (!job.diffFile.empty()) {
+    start = std::chrono::steady_clock::now();
+    std::error_code ec;
+    fs::create_directories(job.diffFile.parent_path(), ec);
+    const bool written = cli.sparseDiff
+                             ? writeSparseDiffFile(job.diffFile, sparseDiff)
+                             : writeRgbaPixelsToPngFile(job.diffFile.string().c_str(), diff,
+                                                        img1->width, img1->height,
+                                                        img1->strideInPixels);
+    if (!written) {
+      result.status = Status::kError;
+      result.message = "failed to write " + job.diffFile.string();
+    }
+    result.writeMs = msSince(start);
+  }
+
+  return result;
+}
+
+/**
+ * Load and compare a pair of images like \ref runComparison, and report exceptions, such as
+ * running out of memory, as an error result of this pair instead of letting them abort the batch.
+ */
+void runComparisonNoThrow(const ComparisonJob& job, const CliOptions& cli, Executor* ioExecutor,
+                          ComparisonResult& result) noexcept {
+  try {
+    result = runComparison(job, cli, ioExecutor);
+  } catch (const std::exception& e) {
+    result = ComparisonResult();
+    try {
+      result.message = e.what();
+    } catch (...) {
+      // Leave the message empty, the status still reports the error.
+    }
+  }
+}
+
+/**
+ * Collect the relative paths of all PNG files under \ref root.
+ *
+ * @param ec Set if the directory tree cannot be listed.
+ */
+std::set<std::string> listPngFiles(const fs::path& root, std::error_code& ec) {
+  std::set<std::string> files;
+  for (fs::recursive_directory_iterator it(root, ec), end; !ec && it != end; it.increment(ec)) {
+    std::string extension = it->path().extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (extension == ".png" && it->is_regular_file(ec) && !ec) {
+      const fs::path relative = fs::relative(it->path(), root, ec);
+      if (ec) {
+        break;
+      }
+
+      files.insert(relative.generic_string());
+    }
+  }
+
+  return files;
+}
+
+/**
+ * Pair the PNG files of two directory trees by relative path.
+ *
+ * @param ec Set if either directory tree cannot be listed.
+ */
+std::vector<ComparisonJob> directoryJobs(const fs::path& dir1, const fs::path& dir2,
+                                         const std::string& diffDir, bool sparseDiff,
+                                         std::error_code& ec) {
+  std::set<std::string> names = listPngFiles(dir1, ec);
+  if (ec) {
+    return {};
+  }
+
+  const std::set<std::string> names2 = listPngFiles(dir2, ec);
+  if (ec) {
+    return {};
+  }
+  names.insert(names2.begin(), names2.end());
+
+  std::vector<ComparisonJob> jobs;
+  for (const std::string& name : names) {
+    fs::path diffFile;
+    if (!diffDir.empty()) {
+      diffFile = fs::path(diffDir) / name;
+      if (sparseDiff) {
+        diffFile.replace_extension(".pmsd");
+      }
+    }
+
+    jobs.push_back(ComparisonJob{name, dir1 / name, dir2 / name, diffFile});
+  }
+
+  return jobs;
+}
+
+std::string jsonEscape(const std::string& value) {
+  std::ostringstream result;
+  for (const char c : value) {
+    switch (c) {
+      case '"': result << "\\\""; break;
+      case '\\': result << "\\\\"; break;
+      case '\n': result << "\\n"; break;
+      case '\t': result << "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buffer[8];
+          std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+          result << buffer;
+        } else {
+          result << c;
+        }
+    }
+  }
+
+  return result.str();
+}
+
+void writeJsonSummary(std::ostream& out, const std::vector<ComparisonJob>& jobs,
+                      const std::vector<ComparisonResult>& results, double totalMs) {
+  size_t counts[4] = {};
+  for (const ComparisonResult& result : results) {
+    ++counts[static_cast<int>(result.status)];
+  }
+
+  out << "{\n";
+  out << "  \"total\": " << results.size() << ",\n";
+  out << "  \"matched\": " << counts[static_cast<int>(Status::kMatch)] << ",\n";
+  out << "  \"different\": " << counts[static_cast<int>(Status::kDifferent)] << ",\n";
+  out << "  \"missing\": " << counts[static_cast<int>(Status::kMissing)] << ",\n";
+  out << "  \"errors\": " << counts[static_cast<int>(Status::kError)] << ",\n";
+  out << "  \"totalMs\": " << totalMs << ",\n";
+  out << "  \"results\": [";
+
+  for (size_t i = 0; i < results.size(); ++i) {
+    const ComparisonResult& result = results[i];
+    out << (i == 0 ? "\n" : ",\n");
+    out << "    {\"name\": \"" << jsonEscape(jobs[i].name) << "\", \"status\": \""
+        << statusName(result.status) << "\", \"diffPixels\": " << result.diffPixels
+        << ", \"totalPixels\": " << result.totalPixels << ", \"loadMs\": " << result.loadMs
+        << ", \"compareMs\": " << result.compareMs << ", \"writeMs\": " << result.writeMs;
+    if (!result.message.empty()) {
+      out << ", \"message\": \"" << jsonEscape(result.message) << "\"";
+    }
+    out << "}";
+  }
+
+  out << (results.empty() ? "]\n" : "\n  ]\n");
+  out << "}\n";
+}
+
+/// Parse a number between \ref min and \ref max, rejecting trailing characters.
+std::optional<float> parseFloat(const std::string& value, float min, float max) {
+  char* end = nullptr;
+  errno = 0;
+  const float result = std::strtof(value.c_str(), &end);
+  if (value.empty() || end != value.c_str() + value.size() || errno == ERANGE ||
+      !std::isfinite(result) || result < min || result > max) {
+    return std::nullopt;
+  }
+
+  return result;
+}
+
+/// Parse an integer between \ref min and \ref max, rejecting trailing characters.
+std::optional<int> parseInt(const std::string& value, int min, int max) {
+  char* end = nullptr;
+  errno = 0;
+  const long result = std::strtol(value.c_str(), &end, 10);
+  if (value.empty() || end != value.c_str() + value.size() || errno == ERANGE || result < min ||
+      result > max) {
+    return std::nullopt;
+  }
+
+  return static_cast<int>(result);
+}
+
+/// Store the parsed value of the flag \ref arg in \ref result, or report it as invalid.
+template <typename T>
+bool setFlag(const std::string& arg, const std::optional<T>& parsed, T& result) {
+  if (!parsed) {
+    std::cerr << "Invalid value: " << arg << "\n";
+    return false;
+  }
+
+  result = *parsed;
+  return true;
+}
+
+bool parseArgs(int argc, char** argv, CliOptions& cli) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto value = [&](const char* prefix) { return arg.substr(std::strlen(prefix)); };
+
+    if (arg == "--help" || arg == "-h") {
+      return false;
+    } else if (arg.rfind("--threshold=", 0) == 0) {
+      if (!setFlag(arg, parseFloat(value("--threshold="), 0.0f, 1.0f), cli.options.threshold)) {
+        return false;
+      }
+    } else if (arg.rfind("--metric=", 0) == 0) {
+      const std::string metric = value("--metric=");
+      if (metric == "yiq") {
+        cli.options.colorMetric = ColorMetric::kYiq;
+      } else if (metric == "oklab") {
+        cli.options.colorMetric = ColorMetric::kOklab;
+      } else if (metric == "ciede2000") {
+        cli.options.colorMetric = ColorMetric::kCiede2000;
+      } else {
+        std::cerr << "Unknown metric: " << metric << "\n";
+        return false;
+      }
+    } else if (arg == "--include-aa") {
+      cli.options.includeAA = true;
+    } else if (arg.rfind("--alpha=", 0) == 0) {
+      if (!setFlag(arg, parseFloat(value("--alpha="), 0.0f, 1.0f), cli.options.alpha)) {
+        return false;
+      }
+    } else if (arg == "--diff-mask") {
+      cli.options.diffMask = true;
+    } else if (arg.rfind("--max-diff=", 0) == 0) {
+      if (!setFlag(arg, parseInt(value("--max-diff="), 0, std::numeric_limits<int>::max()),
+                   cli.maxDiff)) {
+        return false;
+      }
+    } else if (arg.rfind("--diff-dir=", 0) == 0) {
+      cli.diffDir = value("--diff-dir=");
+    } else if (arg == "--sparse-diff") {
+      cli.sparseDiff = true;
+    } else if (arg.rfind("--json=", 0) == 0) {
+      cli.jsonPath = value("--json=");
+    } else if (arg == "-j" && i + 1 < argc) {
+      ++i;
+      if (!setFlag(arg + " " + argv[i], parseInt(argv[i], 1, kMaxJobs), cli.jobs)) {
+        return false;
+      }
+    } else if (arg.rfind("-j", 0) == 0 && arg.size() > 2) {
+      if (!setFlag(arg, parseInt(value("-j"), 1, kMaxJobs), cli.jobs)) {
+        return false;
+      }
+    } else if (arg.rfind("-", 0) == 0) {
+      std::cerr << "Unknown option: " << arg << "\n";
+      return false;
+    } else {
+      cli.positional.push_back(arg);
+    }
+  }
+
+  return cli.positional.size() == 2 || cli.positional.size() == 3;
+}
+
+int runCli(int argc, char** argv) {
+  CliOptions cli;
+  if (!parseArgs(argc, argv, cli)) {
+    std::cerr << kUsage;
+    return 2;
+  }
+
+  std::vector<ComparisonJob> jobs;
+  const fs::path path1 = cli.positional[0];
+  const fs::path path2 = cli.positional[1];
+  std::error_code ec;
+  const bool isDirectory1 = fs::is_directory(path1, ec);
+  const bool isDirectory2 = fs::is_directory(path2, ec);
+  if (isDirectory1 && isDirectory2) {
+    if (cli.positional.size() != 2) {
+      std::cerr << kUsage;
+      return 2;
+    }
+
+    jobs = directoryJobs(path1, path2, cli.diffDir, cli.sparseDiff, ec);
+    if (ec) {
+      std::cerr << "Failed to list " << path1.string() << " and " << path2.string() << ": "
+                << ec.message() << "\n";
+      return 2;
+    }
+  } else {
+    jobs.push_back(ComparisonJob{path1.string(), path1, path2,
+                                 cli.positional.size() == 3 ? fs::path(cli.positional[2])
+                                                            : fs::path()});
+  }
+
+  // The calling thread takes part in the loops, so the pool has one worker less than -j.
+  const size_t numThreads =
+      cli.jobs > 0 ? cli.jobs : std::max(std::thread::hardware_concurrency(), 1u);
+  std::unique_ptr<Executor> executor;
+  if (numThreads > 1) {
+    executor = std::make_unique<ThreadPoolExecutor>(numThreads - 1);
+  } else {
+    executor = std::make_unique<SerialExecutor>();
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<ComparisonResult> results(jobs.size());
+  if (jobs.size() == 1) {
+    // Parallelize the loading and the comparison itself when there is a single pair.
+    cli.options.executor = executor.get();
+    runComparisonNoThrow(jobs[0], cli, executor.get(), results[0]);
+  } else {
+    // The pairs already occupy the pool, so load each pair on the thread comparing it; waiting on
+    // a load queued behind the pairs could deadlock.
+    executor->parallelFor(0, jobs.size(), [&](size_t i) noexcept {
+      runComparisonNoThrow(jobs[i], cli, nullptr, results[i]);
+    });
+  }
+
+  const double totalMs = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+  size_t numMatched = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (results[i].status == Status::kMatch) {
+      ++numMatched;
+      continue;
+    }
+
+    std::cerr << jobs[i].name << ": " << statusName(results[i].status);
+    if (results[i].status == Status::kDifferent && results[i].diffPixels >= 0) {
+      std::cerr << " (" << results[i].diffPixels << " pixels)";
+    }
+    if (!results[i].message.empty()) {
+      std::cerr << ": " << results[i].message;
+    }
+    std::cerr << "\n";
+  }
+
+  if (cli.jsonPath == "-") {
+    writeJsonSummary(std::cout, jobs, results, totalMs);
+  } else if (!cli.jsonPath.empty()) {
+    std::ofstream json(cli.jsonPath);
+    writeJsonSummary(json, jobs, results, totalMs);
+    if (!json) {
+      std::cerr << "Failed to write " << cli.jsonPath << "\n";
+      return 2;
+    }
+  } else if (jobs.size() == 1 && results[0].diffPixels >= 0 &&
+             results[0].status != Status::kError && results[0].status != Status::kMissing) {
+    std::cout << "different pixels: " << results[0].diffPixels << "\n";
+  } else {
+    std::cout << numMatched << "/" << results.size() << " images match\n";
+  }
+
+  return numMatched == results.size() ? 0 : 1;
+}
+
+}  // namespace
+}  // namespace pixelmatch
+
+int main(int argc, char** argv) {
+  // Failures of a single pair are reported in its result, this only catches running out of memory
+  // while setting up the batch.
+  try {
+    return pixelmatch::runCli(argc, argv);
+  } catch (const std::exception& e) {
+    std::cerr << "pixelmatch_cli: " << e.what() << "\n";
+    return 2;
+  }
+}
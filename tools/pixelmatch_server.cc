@@ -0,0 +1,249 @@
+/**
+ * pixelmatch_server: compares images on request over a local Unix socket, keeping decoded golden
+ * images in memory so that each golden is only decoded once.
+ *
+ * Usage: pixelmatch_server --socket=<path> [--cache-mb=<n>] [--max-connections=<n>]
+ *
+ * Each connection is served on its own thread, up to --max-connections at once (64 by default).
+ * Connections past the limit receive "ERROR server busy" and are closed.
+ *
+ * See \ref pixelmatch::ComparisonService for the protocol. For example, with socat:
+ *
+ *   printf 'COMPARE\tgolden.png\tcandidate.png\tdiff=diff.png\n' | socat - UNIX-CONNECT:<path>
+ */
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include "comparison_service.h"
+
+namespace pixelmatch {
+namespace {
+
+/// Maximum length of a request line. Longer requests close the connection, so that a client that
+/// never sends a newline cannot grow the read buffer without bound.
+constexpr size_t kMaxRequestBytes = 64 * 1024;
+
+bool writeAll(int fd, const char* data, size_t size) noexcept {
+  size_t written = 0;
+  while (written < size) {
+    const ssize_t result = ::write(fd, data + written, size - written);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+
+    written += static_cast<size_t>(result);
+  }
+
+  return true;
+}
+
+bool writeAll(int fd, const std::string& data) noexcept {
+  return writeAll(fd, data.data(), data.size());
+}
+
+/// Write a constant response, without allocating.
+template <size_t N>
+bool writeAll(int fd, const char (&response)[N]) noexcept {
+  return writeAll(fd, response, N - 1);
+}
+
+/// Serve requests from a single connection until it is closed. May throw, such as std::bad_alloc
+/// if a request cannot be handled, see \ref serveConnectionAndClose.
+void serveConnection(ComparisonService& service, int fd) {
+  std::string buffer;
+  char chunk[4096];
+
+  for (;;) {
+    const ssize_t bytesRead = ::read(fd, chunk, sizeof(chunk));
+    if (bytesRead < 0 && errno == EINTR) {
+      continue;
+    } else if (bytesRead <= 0) {
+      break;
+    }
+
+    buffer.append(chunk, static_cast<size_t>(bytesRead));
+
+    size_t newline;
+    while ((newline = buffer.find('\n')) != std::string::npos) {
+      const std::string request = buffer.substr(0, newline);
+      buffer.erase(0, newline + 1);
+
+      if (!writeAll(fd, service.handleRequest(request) + "\n")) {
+        return;
+      }
+    }
+
+    if (buffer.size() > kMaxRequestBytes) {
+      writeAll(fd, "ERROR request too long\n");
+      return;
+    }
+  }
+}
+
+/**
+ * Serve a connection and close it. If a request fails with an exception, such as running out of
+ * memory while decoding a large image, the client gets an error and only this connection is closed,
+ * since the exception would otherwise terminate the whole server from the connection thread.
+ */
+void serveConnectionAndClose(ComparisonService& service, int fd) noexcept {
+  try {
+    serveConnection(service, fd);
+  } catch (const std::bad_alloc&) {
+    writeAll(fd, "ERROR out of memory\n");
+  } catch (...) {
+    writeAll(fd, "ERROR internal error\n");
+  }
+
+  ::close(fd);
+}
+
+/**
+ * Remove a socket left by a previous run, refusing to remove any other kind of file.
+ *
+ * @return false if the path exists and is not a socket, or could not be removed.
+ */
+bool removeStaleSocket(const std::string& socketPath) {
+  struct stat info;
+  if (::lstat(socketPath.c_str(), &info) != 0) {
+    if (errno == ENOENT) {
+      return true;
+    }
+
+    std::perror("lstat");
+    return false;
+  }
+
+  if (!S_ISSOCK(info.st_mode)) {
+    std::fprintf(stderr, "Refusing to replace %s, which is not a socket\n", socketPath.c_str());
+    return false;
+  }
+
+  if (::unlink(socketPath.c_str()) != 0) {
+    std::perror("unlink");
+    return false;
+  }
+
+  return true;
+}
+
+int runServer(const std::string& socketPath, size_t cacheBudgetBytes, size_t maxConnections) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    std::fprintf(stderr, "Socket path is too long: %s\n", socketPath.c_str());
+    return 1;
+  }
+  std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+  const int listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0) {
+    std::perror("socket");
+    return 1;
+  }
+
+  if (!removeStaleSocket(socketPath)) {
+    return 1;
+  }
+
+  if (::bind(listenFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+    std::perror("bind");
+    return 1;
+  }
+
+  if (::listen(listenFd, SOMAXCONN) != 0) {
+    std::perror("listen");
+    return 1;
+  }
+
+  std::fprintf(stderr, "Listening on %s with a %zu MB golden cache\n", socketPath.c_str(),
+               cacheBudgetBytes / (1024 * 1024));
+
+  ComparisonService service(cacheBudgetBytes);
+  std::atomic<size_t> activeConnections{0};
+  for (;;) {
+    const int fd = ::accept(listenFd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      // Errors such as ECONNABORTED only affect one connection, and running out of descriptors
+      // or memory is usually temporary, so keep serving. Back off briefly so that a persistent
+      // error does not spin.
+      std::perror("accept");
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      continue;
+    }
+
+    if (activeConnections.load() >= maxConnections) {
+      writeAll(fd, "ERROR server busy\n");
+      ::close(fd);
+      continue;
+    }
+
+    ++activeConnections;
+    try {
+      std::thread([&service, &activeConnections, fd]() noexcept {
+        serveConnectionAndClose(service, fd);
+        --activeConnections;
+      }).detach();
+    } catch (const std::system_error& e) {
+      std::fprintf(stderr, "Failed to start a connection thread: %s\n", e.what());
+      --activeConnections;
+      ::close(fd);
+    }
+  }
+}
+
+}  // namespace
+}  // namespace pixelmatch
+
+int main(int argc, char** argv) {
+  std::string socketPath;
+  size_t cacheMegabytes = 1024;
+  size_t maxConnections = 64;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg.rfind("--socket=", 0) == 0) {
+      socketPath = arg.substr(strlen("--socket="));
+    } else if (arg.rfind("--cache-mb=", 0) == 0) {
+      cacheMegabytes = std::strtoull(arg.c_str() + strlen("--cache-mb="), nullptr, 10);
+    } else if (arg.rfind("--max-connections=", 0) == 0) {
+      maxConnections = std::strtoull(arg.c_str() + strlen("--max-connections="), nullptr, 10);
+    } else {
+      socketPath.clear();
+      break;
+    }
+  }
+
+  if (socketPath.empty() || maxConnections == 0) {
+    std::fprintf(stderr,
+                 "Usage: %s --socket=<path> [--cache-mb=<n>] [--max-connections=<n>]\n",
+                 argv[0]);
+    return 1;
+  }
+
+  // Clients disconnecting while a response is written should not terminate the server.
+  ::signal(SIGPIPE, SIG_IGN);
+
+  return pixelmatch::runServer(socketPath, cacheMegabytes * 1024 * 1024, maxConnections);
+}